@@ -1,10 +1,40 @@
 #pragma once
 #include <opencv2/opencv.hpp>
 #include <opencv2/features2d.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <filesystem>
+#include <fstream>
 #include <sstream>
 #include <algorithm>
+#include <array>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <map>
+#include <unordered_map>
+#include <utility>
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+#include <immintrin.h>
+#define IP_X86_DISPATCH 1
+#define IP_TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define IP_TARGET_AVX512 __attribute__((target("avx512f,avx512bw,avx2,popcnt")))
+#define IP_ALWAYS_INLINE __attribute__((always_inline)) inline
+#define IP_AVX2_KERNEL(fn) (&fn)
+#define IP_AVX512_KERNEL(fn) (&fn)
+#else
+#define IP_X86_DISPATCH 0
+#define IP_ALWAYS_INLINE inline
+#define IP_AVX2_KERNEL(fn) nullptr
+#define IP_AVX512_KERNEL(fn) nullptr
+#endif
 
 #ifdef _WIN32
 #include <windows.h>
@@ -16,10 +46,420 @@
 #elif __linux__
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
+#include <poll.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if __has_include(<X11/extensions/Xdamage.h>)
+#include <X11/extensions/Xdamage.h>
+#define IP_HAVE_XDAMAGE 1
+#endif
+#if __has_include(<X11/extensions/Xrandr.h>)
+#include <X11/extensions/Xrandr.h>
+#define IP_HAVE_XRANDR 1
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <optional>
+#define IP_HAVE_COROUTINES 1
+#endif
 #endif
 
 class IP {
 public:
+    // Lock-free bounded multi-producer/multi-consumer queue (Vyukov). Pushes fail instead of
+    // blocking when the queue is full.
+    template<typename T>
+    class BoundedQueue {
+    public:
+        explicit BoundedQueue(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            mask_ = size - 1;
+            cells_.reset(new Cell[size]);
+            for (size_t i = 0; i < size; ++i) {
+                cells_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool tryPush(T&& value) {
+            size_t pos = tail_.load(std::memory_order_relaxed);
+            Cell* cell;
+            for (;;) {
+                cell = &cells_[pos & mask_];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+                if (diff == 0) {
+                    if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = tail_.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool tryPop(T& value) {
+            size_t pos = head_.load(std::memory_order_relaxed);
+            Cell* cell;
+            for (;;) {
+                cell = &cells_[pos & mask_];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos + 1);
+                if (diff == 0) {
+                    if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                }
+                else if (diff < 0) {
+                    return false;
+                }
+                else {
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+            value = std::move(cell->value);
+            cell->value = T();
+            cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const { return mask_ + 1; }
+
+        size_t sizeApprox() const {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t head = head_.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::unique_ptr<Cell[]> cells_;
+        size_t mask_ = 0;
+        alignas(64) std::atomic<size_t> head_{ 0 };
+        alignas(64) std::atomic<size_t> tail_{ 0 };
+    };
+
+    // Parks the single consumer of a BoundedQueue while the queue is empty. Producers call notify()
+    // after every push; it costs one fence and a relaxed load unless the consumer is parked, so
+    // pushes stay lock-free in the common case. The fences pair up so that either the producer sees
+    // the consumer parked, or the consumer's ready() check sees the push.
+    class Parker {
+    public:
+        void notify() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (parked_.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                signalled_ = true;
+                wake_.notify_one();
+            }
+        }
+
+        // Blocks until notify() is called or ready() returns true.
+        template<typename Ready>
+        void park(Ready ready) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            parked_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake_.wait(lock, [&] { return signalled_ || ready(); });
+            signalled_ = false;
+            parked_.store(false, std::memory_order_relaxed);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::atomic<bool> parked_{ false };
+        bool signalled_ = false;
+    };
+
+    // Picks the widest instruction set a kernel was compiled for that the running CPU supports.
+    // Kernels are built for the baseline (SSE2 on x86-64, NEON on AArch64, via OpenCV universal
+    // intrinsics) and, with GCC or Clang on x86, additionally for AVX2 and AVX-512BW.
+    class CpuDispatch {
+    public:
+        enum class Level { Baseline = 0, AVX2 = 1, AVX512 = 2 };
+
+        static Level detected() {
+            static const Level level = detect();
+            return level;
+        }
+
+        // IP_CPU_DISPATCH=baseline|avx2|avx512 lowers the level for benchmarking. It never raises
+        // the level above what the CPU supports.
+        static Level active() {
+            static const Level level = [] {
+                Level wanted = detected();
+                if (const char* env = std::getenv("IP_CPU_DISPATCH")) {
+                    std::string name(env);
+                    if (name == "baseline") wanted = Level::Baseline;
+                    else if (name == "avx2") wanted = Level::AVX2;
+                    else if (name == "avx512") wanted = Level::AVX512;
+                }
+                return std::min(wanted, detected());
+            }();
+            return level;
+        }
+
+        static const char* name(Level level) {
+            switch (level) {
+            case Level::AVX2: return "avx2";
+            case Level::AVX512: return "avx512";
+            default: break;
+            }
+#if defined(__aarch64__) || defined(__ARM_NEON)
+            return "neon";
+#elif defined(__SSE2__) || defined(_M_X64)
+            return "sse2";
+#else
+            return "scalar";
+#endif
+        }
+
+        template<typename Fn>
+        struct Kernel {
+            Fn baseline;
+            Fn avx2;
+            Fn avx512;
+
+            Fn select() const {
+                Level level = active();
+                if (level >= Level::AVX512 && avx512) {
+                    return avx512;
+                }
+                if (level >= Level::AVX2 && avx2) {
+                    return avx2;
+                }
+                return baseline;
+            }
+        };
+
+    private:
+        static Level detect() {
+#if IP_X86_DISPATCH
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+                return Level::AVX512;
+            }
+            if (__builtin_cpu_supports("avx2")) {
+                return Level::AVX2;
+            }
+#endif
+            return Level::Baseline;
+        }
+    };
+
+    enum class ErrorCode {
+        Ok = 0,
+        EmptyImage,
+        InvalidROI,
+        InvalidDirection,
+        NoDescriptors,
+        NoMatches,
+        NotEnoughMatches,
+        HomographyFailed,
+        OutOfBounds,
+        AspectMismatch,
+        BelowThreshold,
+        DisplayUnavailable,
+        Timeout,
+        UnsupportedType,
+        UnknownTemplate,
+        NotPermitted,
+        MatchFailed
+    };
+
+    static const char* errorMessage(ErrorCode code) {
+        switch (code) {
+        case ErrorCode::Ok: return "Ok";
+        case ErrorCode::EmptyImage: return "Input image is empty";
+        case ErrorCode::InvalidROI: return "Invalid ROI";
+        case ErrorCode::InvalidDirection: return "Invalid direction";
+        case ErrorCode::NoDescriptors: return "One or both images failed to produce descriptors";
+        case ErrorCode::NoMatches: return "No matches found between descriptors";
+        case ErrorCode::NotEnoughMatches: return "Not enough good matches found to compute homography";
+        case ErrorCode::HomographyFailed: return "Homography computation failed";
+        case ErrorCode::OutOfBounds: return "Match lies outside the image";
+        case ErrorCode::AspectMismatch: return "Match aspect ratio differs from the template";
+        case ErrorCode::BelowThreshold: return "Match score is below the threshold";
+        case ErrorCode::Timeout: return "Timed out waiting for the condition";
+        case ErrorCode::DisplayUnavailable: return "Cannot open display";
+        case ErrorCode::UnsupportedType: return "Image type is not supported";
+        case ErrorCode::UnknownTemplate: return "Unknown template id";
+        case ErrorCode::NotPermitted: return "The server does not allow this request";
+        case ErrorCode::MatchFailed: return "The search raised an error";
+        }
+        return "Unknown error";
+    }
+
+    // Value-or-error returned by the try* searches. Misses are expected and carry the code that
+    // rejected them plus the last diagnostic score, so callers can decide without any logging.
+    template<typename T>
+    class Result {
+    public:
+        Result(T value, double score = 0.0) : value_(std::move(value)), error_(ErrorCode::Ok), score_(score) {}
+
+        static Result failure(ErrorCode error, double score = 0.0) {
+            Result result;
+            result.error_ = error;
+            result.score_ = score;
+            return result;
+        }
+
+        bool ok() const { return error_ == ErrorCode::Ok; }
+        explicit operator bool() const { return ok(); }
+        ErrorCode error() const { return error_; }
+        double score() const { return score_; }
+
+        const T& value() const {
+            if (!ok()) {
+                throw std::logic_error(std::string("Result holds an error: ") + errorMessage(error_));
+            }
+            return value_;
+        }
+
+        T valueOr(T fallback) const { return ok() ? value_ : std::move(fallback); }
+
+        const T& operator*() const { return value(); }
+        const T* operator->() const { return &value(); }
+
+    private:
+        Result() : value_(), error_(ErrorCode::Ok), score_(0.0) {}
+
+        T value_;
+        ErrorCode error_;
+        double score_;
+    };
+
+    // Rate-limited asynchronous failure log used by the legacy entry points in place of std::cerr.
+    // Each error code may emit at most ratePerSecond lines per second; the rest are counted and
+    // summarised with the next line that gets through. Writing happens on a background thread that
+    // sleeps until a line is queued.
+    class Log {
+    public:
+        enum class Level { Off, Error };
+
+        static Log& instance() {
+            static Log log;
+            return log;
+        }
+
+        ~Log() {
+            stop_.store(true);
+            parker_.notify();
+            if (worker_.joinable()) {
+                worker_.join();
+            }
+        }
+
+        void setLevel(Level level) { level_.store(level, std::memory_order_relaxed); }
+        void setRatePerSecond(int rate) { rate_.store(std::max(rate, 0), std::memory_order_relaxed); }
+
+        void setSink(std::function<void(const std::string&)> sink) {
+            std::lock_guard<std::mutex> lock(sinkMutex_);
+            sink_ = std::move(sink);
+        }
+
+        void report(ErrorCode code, const char* where, double score = 0.0) {
+            if (level_.load(std::memory_order_relaxed) == Level::Off) {
+                return;
+            }
+            Counter& counter = counters_[static_cast<size_t>(code) % counters_.size()];
+            int64_t second = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            int64_t window = counter.window.load(std::memory_order_relaxed);
+            if (window != second && counter.window.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+                counter.emitted.store(0, std::memory_order_relaxed);
+            }
+            if (counter.emitted.fetch_add(1, std::memory_order_relaxed) >= rate_.load(std::memory_order_relaxed)) {
+                counter.suppressed.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Entry entry{ code, where, score, counter.suppressed.exchange(0, std::memory_order_relaxed) };
+            std::call_once(started_, [this] { worker_ = std::thread(&Log::run, this); });
+            if (!queue_.tryPush(std::move(entry))) {
+                counter.suppressed.fetch_add(1 + entry.suppressed, std::memory_order_relaxed);
+                return;
+            }
+            parker_.notify();
+        }
+
+    private:
+        struct Entry {
+            ErrorCode code = ErrorCode::Ok;
+            const char* where = "";
+            double score = 0.0;
+            uint64_t suppressed = 0;
+        };
+
+        struct Counter {
+            std::atomic<int64_t> window{ 0 };
+            std::atomic<int> emitted{ 0 };
+            std::atomic<uint64_t> suppressed{ 0 };
+        };
+
+        Log() : queue_(256) {}
+
+        void run() {
+            Entry entry;
+            for (;;) {
+                if (!queue_.tryPop(entry)) {
+                    if (stop_.load()) {
+                        return;
+                    }
+                    parker_.park([this] { return stop_.load() || queue_.sizeApprox() > 0; });
+                    continue;
+                }
+                std::ostringstream line;
+                line << "IP::" << entry.where << ": " << errorMessage(entry.code);
+                if (entry.score != 0.0) {
+                    line << " (score " << entry.score << ")";
+                }
+                if (entry.suppressed > 0) {
+                    line << " [" << entry.suppressed << " similar suppressed]";
+                }
+                std::lock_guard<std::mutex> lock(sinkMutex_);
+                if (sink_) {
+                    sink_(line.str());
+                }
+                else {
+                    std::cerr << line.str() << std::endl;
+                }
+            }
+        }
+
+        BoundedQueue<Entry> queue_;
+        std::array<Counter, 16> counters_;
+        std::atomic<Level> level_{ Level::Error };
+        std::atomic<int> rate_{ 5 };
+        std::once_flag started_;
+        std::thread worker_;
+        std::atomic<bool> stop_{ false };
+        Parker parker_;
+        std::mutex sinkMutex_;
+        std::function<void(const std::string&)> sink_;
+    };
+
     static cv::Mat rotateImage(const cv::Mat& image, const std::string& direction, double angle) {
         cv::Point2f center(image.cols / 2.0, image.rows / 2.0);
 
@@ -27,7 +467,7 @@ public:
             angle = -angle;
         }
         else if (direction != "right") {
-            std::cerr << "Invalid direction. Use 'left' or 'right'." << std::endl;
+            logFailure(ErrorCode::InvalidDirection, "rotateImage");
             return image;
         }
 
@@ -40,7 +480,12 @@ public:
         return rotatedImage;
     }
 
-    static cv::Rect findImageInImage(const cv::Mat& largeImage, const cv::Mat& smallImage, double scale = 1.0, bool grayscale = false) {
+    static cv::Rect findImageInImage(const cv::Mat& largeImage, const cv::Mat& smallImage, double scale = 1.0, bool grayscale = false, bool debug = false) {
+        return *tryFindImageInImage(largeImage, smallImage, scale, grayscale, debug);
+    }
+
+    // Same search as findImageInImage, also reporting the TM_CCOEFF_NORMED score of the best match.
+    static Result<cv::Rect> tryFindImageInImage(const cv::Mat& largeImage, const cv::Mat& smallImage, double scale = 1.0, bool grayscale = false, bool debug = false) {
         if (scale <= 0.0 || scale > 1.0) {
             throw std::invalid_argument("Scale must be between 0 and 1.");
         }
@@ -70,614 +515,5667 @@ public:
 
         cv::Rect matchRect(maxLoc.x, maxLoc.y, smallCopy.cols, smallCopy.rows);
 
-        int x = static_cast<int>(matchRect.x / scale);
-        int y = static_cast<int>(matchRect.y / scale);
-        int width = static_cast<int>(matchRect.width / scale);
-        int height = static_cast<int>(matchRect.height / scale);
-
-        x = (x < 0) ? 0 : (x + width > largeImage.cols) ? largeImage.cols - width : x;
-        y = (y < 0) ? 0 : (y + height > largeImage.rows) ? largeImage.rows - height : y;
+        if (debug && DebugSink::instance().accepting()) {
+            DebugRecord record("template", largeCopy, smallCopy);
+            record.rects.push_back(matchRect);
+            record.score = maxVal;
+            DebugSink::instance().push(std::move(record));
+        }
 
-        cv::Rect roi(x, y, width, height);
-        return roi;
+        return Result<cv::Rect>(unscaleRect(matchRect, scale, largeImage.size()), maxVal);
     }
 
-    static cv::Rect findImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage, int minMatchScore = 230, double scale = 1.0, bool debug = false) {
-        if (scale <= 0.0 || scale > 1.0) {
-            throw std::invalid_argument("Scale must be between 0 and 1.");
-        }
-        
-        minMatchScore = std::clamp(minMatchScore, 0, 256);
-
-        cv::Mat largeCopy, smallCopy;
+    // Cross-correlation in the frequency domain. The frame is split into overlap-save tiles whose
+    // real-to-complex spectra are computed once in setFrame(), so every template searched in the
+    // same frame costs only a pointwise product and one inverse transform per tile.
+    class FFTMatcher {
+    public:
+        class Template {
+        public:
+            explicit Template(const cv::Mat& image) {
+                if (image.empty()) {
+                    throw std::invalid_argument("Template image is empty.");
+                }
+                size_ = image.size();
+                image.convertTo(zeroMean_, CV_32F);
+                cv::subtract(zeroMean_, cv::mean(zeroMean_), zeroMean_);
+                norm2_ = cv::norm(zeroMean_, cv::NORM_L2SQR);
+            }
 
-        if (scale != 1.0) {
-            cv::resize(largeImage, largeCopy, cv::Size(), scale, scale);
-            cv::resize(smallImage, smallCopy, cv::Size(), scale, scale);
-        }
-        else {
-            largeCopy = largeImage;
-            smallCopy = smallImage;
-        }
+            cv::Size size() const { return size_; }
+            int channels() const { return zeroMean_.channels(); }
 
-        std::vector<cv::KeyPoint> keypointsLarge, keypointsSmall;
-        cv::Mat descriptorsLarge, descriptorsSmall;
+        private:
+            friend class FFTMatcher;
 
-        computeKeypointsAndDescriptors(largeCopy, keypointsLarge, descriptorsLarge);
-        computeKeypointsAndDescriptors(smallCopy, keypointsSmall, descriptorsSmall);
+            const std::vector<cv::Mat>& spectra(const cv::Size& block) const {
+                if (block == block_ && !spectra_.empty()) {
+                    return spectra_;
+                }
+                std::vector<cv::Mat> planes;
+                cv::split(zeroMean_, planes);
+                spectra_.assign(planes.size(), cv::Mat());
+                for (size_t c = 0; c < planes.size(); ++c) {
+                    cv::Mat padded = cv::Mat::zeros(block, CV_32F);
+                    planes[c].copyTo(padded(cv::Rect(0, 0, size_.width, size_.height)));
+                    cv::dft(padded, spectra_[c], 0, size_.height);
+                }
+                block_ = block;
+                return spectra_;
+            }
 
-        if (descriptorsLarge.empty() || descriptorsSmall.empty()) {
-            std::cerr << "Error: One or both images failed to produce descriptors.\n";
-            return cv::Rect(0, 0, 0, 0);
-        }
+            cv::Size size_;
+            cv::Mat zeroMean_;
+            double norm2_ = 0.0;
+            mutable cv::Size block_;
+            mutable std::vector<cv::Mat> spectra_;
+        };
 
-        if (debug) {
-            cv::Mat largeKeypointsImg, smallKeypointsImg;
-            cv::drawKeypoints(largeCopy, keypointsLarge, largeKeypointsImg, cv::Scalar(0, 255, 0));
-            cv::drawKeypoints(smallCopy, keypointsSmall, smallKeypointsImg, cv::Scalar(0, 255, 0));
+        explicit FFTMatcher(int maxTemplateSide = 256) : maxTemplateSide_(std::max(maxTemplateSide, 1)) {}
 
-            cv::imshow("Large Image Keypoints", largeKeypointsImg);
-            cv::imshow("Small Image Keypoints", smallKeypointsImg);
-        }
+        void setFrame(const cv::Mat& frame) {
+            if (frame.empty()) {
+                throw std::invalid_argument("The frame is empty.");
+            }
+            frameSize_ = frame.size();
+            channels_ = frame.channels();
+            cv::integral(frame, sum_, sqsum_, CV_64F, CV_64F);
 
-        cv::BFMatcher matcher(cv::NORM_HAMMING, true);
-        std::vector<cv::DMatch> matches;
-        matcher.match(descriptorsSmall, descriptorsLarge, matches);
+            block_ = cv::Size(blockExtent(frame.cols), blockExtent(frame.rows));
+            step_ = cv::Size(block_.width >= frame.cols ? frame.cols : block_.width - maxTemplateSide_ + 1,
+                block_.height >= frame.rows ? frame.rows : block_.height - maxTemplateSide_ + 1);
 
-        if (matches.empty()) {
-            std::cerr << "Error: No matches found between descriptors.\n";
-            return cv::Rect(0, 0, 0, 0);
-        }
-        
-        float minDistance = std::min_element(matches.begin(), matches.end(),
-            [](const cv::DMatch& a, const cv::DMatch& b) {
-                return a.distance < b.distance;
-            })->distance;
-        
-        float maxAcceptableDistance = minDistance + (minMatchScore / 256.0f * 256.0f);
-        std::vector<cv::DMatch> goodMatches;
-        std::copy_if(matches.begin(), matches.end(), std::back_inserter(goodMatches),
-            [maxAcceptableDistance](const cv::DMatch& m) {
-                return m.distance <= maxAcceptableDistance;
-            });
+            cv::Mat frame32;
+            frame.convertTo(frame32, CV_32F);
+            std::vector<cv::Mat> planes;
+            cv::split(frame32, planes);
 
-        if (debug) {
-            cv::Mat matchImg;
-            cv::drawMatches(smallCopy, keypointsSmall, largeCopy, keypointsLarge, goodMatches, matchImg);
+            tiles_.clear();
+            for (int y0 = 0; y0 < frame.rows; y0 += step_.height) {
+                for (int x0 = 0; x0 < frame.cols; x0 += step_.width) {
+                    tiles_.push_back({ cv::Point(x0, y0), std::vector<cv::Mat>(planes.size()) });
+                }
+            }
 
-            cv::imshow("Matches", matchImg);
-            cv::waitKey(0); 
+            cv::parallel_for_(cv::Range(0, static_cast<int>(tiles_.size())), [&](const cv::Range& range) {
+                for (int i = range.start; i < range.end; ++i) {
+                    Tile& tile = tiles_[i];
+                    cv::Rect source = cv::Rect(tile.origin, block_) & cv::Rect(0, 0, frame.cols, frame.rows);
+                    for (size_t c = 0; c < planes.size(); ++c) {
+                        cv::Mat padded = cv::Mat::zeros(block_, CV_32F);
+                        planes[c](source).copyTo(padded(cv::Rect(0, 0, source.width, source.height)));
+                        cv::dft(padded, tile.spectra[c], 0, source.height);
+                    }
+                }
+            });
         }
 
-        
-        if (goodMatches.size() < 4) {
-            std::cerr << "Error: Not enough good matches found to compute homography.\n";
-            return cv::Rect(0, 0, 0, 0);
-        }
-        
-        std::vector<cv::Point2f> pointsSmall, pointsLarge;
-        for (const auto& match : goodMatches) {
-            pointsSmall.push_back(keypointsSmall[match.queryIdx].pt);
-            pointsLarge.push_back(keypointsLarge[match.trainIdx].pt);
-        }
-        
-        cv::Mat homography = cv::findHomography(pointsSmall, pointsLarge, cv::RANSAC);
-        
-        if (homography.empty()) {
-            std::cerr << "Error: Homography computation failed.\n";
-            return cv::Rect(0, 0, 0, 0);
-        }
-        
-        std::vector<cv::Point2f> smallCorners = {
-            cv::Point2f(0, 0),
-            cv::Point2f(static_cast<float>(smallCopy.cols), 0),
-            cv::Point2f(static_cast<float>(smallCopy.cols), static_cast<float>(smallCopy.rows)),
-            cv::Point2f(0, static_cast<float>(smallCopy.rows))
-        };
+        bool hasFrame() const { return !tiles_.empty(); }
 
-        std::vector<cv::Point2f> largeCorners(4);
-        cv::perspectiveTransform(smallCorners, largeCorners, homography);
+        // DFT block the current frame was split into; template spectra are computed at this size.
+        cv::Size blockSize() const { return block_; }
 
-        cv::Rect boundingRect = cv::boundingRect(largeCorners);
-        if (!isAspectRatioClose(boundingRect, smallImage, 0.2)) {
-            return cv::Rect(0, 0, 0, 0);
-        }
-        return boundingRect;
-    }
+        // Returns the TM_CCOEFF_NORMED response map, identical in layout to cv::matchTemplate.
+        cv::Mat correlate(const Template& templ) const {
+            if (!hasFrame()) {
+                throw std::logic_error("FFTMatcher::setFrame must be called before correlate.");
+            }
+            if (templ.channels() != channels_) {
+                throw std::invalid_argument("Template and frame channel counts differ.");
+            }
+            const cv::Size tsize = templ.size();
+            if (tsize.width > frameSize_.width || tsize.height > frameSize_.height) {
+                throw std::invalid_argument("Template is larger than the frame.");
+            }
+            if ((block_.width < frameSize_.width && tsize.width > maxTemplateSide_) ||
+                (block_.height < frameSize_.height && tsize.height > maxTemplateSide_)) {
+                throw std::invalid_argument("Template exceeds the maximum side this matcher was configured for.");
+            }
 
-    static cv::Rect findImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage,
-        const std::vector<cv::KeyPoint>& keypointsLarge, const cv::Mat& descriptorsLarge,
-        const std::vector<cv::KeyPoint>& keypointsSmall, const cv::Mat& descriptorsSmall,
-        int minMatchScore = 230, bool debug = false) {
-        
-        minMatchScore = std::clamp(minMatchScore, 0, 256);
+            const std::vector<cv::Mat>& templSpectra = templ.spectra(block_);
+            cv::Mat result(frameSize_.height - tsize.height + 1, frameSize_.width - tsize.width + 1, CV_32F);
 
-        if (descriptorsLarge.empty() || descriptorsSmall.empty()) {
-            std::cerr << "Error: One or both sets of descriptors are empty.\n";
-            return cv::Rect(0, 0, 0, 0);
-        }
+            cv::parallel_for_(cv::Range(0, static_cast<int>(tiles_.size())), [&](const cv::Range& range) {
+                cv::Mat product, accum, corr;
+                for (int i = range.start; i < range.end; ++i) {
+                    const Tile& tile = tiles_[i];
+                    cv::Rect valid = cv::Rect(tile.origin, step_) & cv::Rect(0, 0, result.cols, result.rows);
+                    if (valid.empty()) {
+                        continue;
+                    }
+                    for (size_t c = 0; c < templSpectra.size(); ++c) {
+                        cv::mulSpectrums(tile.spectra[c], templSpectra[c], c == 0 ? accum : product, 0, true);
+                        if (c > 0) {
+                            cv::add(accum, product, accum);
+                        }
+                    }
+                    cv::dft(accum, corr, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, valid.height);
+                    corr(cv::Rect(0, 0, valid.width, valid.height)).copyTo(result(valid));
+                }
+            });
 
-        cv::BFMatcher matcher(cv::NORM_HAMMING, true);
-        std::vector<cv::DMatch> matches;
-        matcher.match(descriptorsSmall, descriptorsLarge, matches);
+            normalize(result, tsize, templ.norm2_);
+            return result;
+        }
 
-        if (matches.empty()) {
-            std::cerr << "Error: No matches found between descriptors.\n";
-            return cv::Rect(0, 0, 0, 0);
+        cv::Rect find(const Template& templ, double* score = nullptr) const {
+            cv::Mat result = correlate(templ);
+            double maxVal;
+            cv::Point maxLoc;
+            cv::minMaxLoc(result, nullptr, &maxVal, nullptr, &maxLoc);
+            if (score) {
+                *score = maxVal;
+            }
+            return cv::Rect(maxLoc, templ.size());
         }
 
-        float minDistance = std::min_element(matches.begin(), matches.end(),
-            [](const cv::DMatch& a, const cv::DMatch& b) {
-                return a.distance < b.distance;
-            })->distance;
+    private:
+        static constexpr int kSingleTileExtent = 1024;
 
-        float maxAcceptableDistance = minDistance + (minMatchScore / 256.0f * 256.0f);
-        std::vector<cv::DMatch> goodMatches;
-        std::copy_if(matches.begin(), matches.end(), std::back_inserter(goodMatches),
-            [maxAcceptableDistance](const cv::DMatch& m) {
-                return m.distance <= maxAcceptableDistance;
-            });
+        struct Tile {
+            cv::Point origin;
+            std::vector<cv::Mat> spectra;
+        };
 
-        if (debug) {
-            cv::Mat matchImg;
-            cv::drawMatches(smallImage, keypointsSmall, largeImage, keypointsLarge, goodMatches, matchImg);
+        int blockExtent(int extent) const {
+            int tiled = cv::getOptimalDFTSize(std::max(4 * maxTemplateSide_, 512));
+            if (extent <= kSingleTileExtent || tiled >= extent) {
+                return cv::getOptimalDFTSize(extent);
+            }
+            return tiled;
+        }
 
-            cv::imshow("Matches", matchImg);
-            cv::waitKey(0); 
+        void normalize(cv::Mat& result, const cv::Size& tsize, double templNorm2) const {
+            const int cn = channels_;
+            const double invArea = 1.0 / (static_cast<double>(tsize.width) * tsize.height);
+            for (int y = 0; y < result.rows; ++y) {
+                const double* s0 = sum_.ptr<double>(y);
+                const double* s1 = sum_.ptr<double>(y + tsize.height);
+                const double* q0 = sqsum_.ptr<double>(y);
+                const double* q1 = sqsum_.ptr<double>(y + tsize.height);
+                float* out = result.ptr<float>(y);
+                for (int x = 0; x < result.cols; ++x) {
+                    const int l = x * cn;
+                    const int r = (x + tsize.width) * cn;
+                    double variance = 0.0;
+                    for (int c = 0; c < cn; ++c) {
+                        double s = s1[r + c] - s1[l + c] - s0[r + c] + s0[l + c];
+                        double q = q1[r + c] - q1[l + c] - q0[r + c] + q0[l + c];
+                        variance += q - s * s * invArea;
+                    }
+                    double denom = std::sqrt(std::max(variance, 0.0) * templNorm2);
+                    out[x] = denom > DBL_EPSILON ? static_cast<float>(std::clamp(out[x] / denom, -1.0, 1.0)) : 0.0f;
+                }
+            }
         }
 
-        if (goodMatches.size() < 4) {
-            std::cerr << "Error: Not enough good matches found to compute homography.\n";
-            return cv::Rect(0, 0, 0, 0);
+        int maxTemplateSide_;
+        int channels_ = 0;
+        cv::Size frameSize_;
+        cv::Size block_;
+        cv::Size step_;
+        cv::Mat sum_, sqsum_;
+        std::vector<Tile> tiles_;
+    };
+
+    // Templates prepared by findImagesInImage, kept across calls up to a budget of spectrum bytes.
+    // Keys cover the template's content and the DFT block size, and an entry is inserted only after
+    // a search has computed its spectra for that block, so cached templates are only ever read and
+    // may be shared between threads.
+    class FFTTemplateCache {
+    public:
+        static FFTTemplateCache& instance() {
+            static FFTTemplateCache cache(size_t(64) << 20);
+            return cache;
         }
 
-        std::vector<cv::Point2f> pointsSmall, pointsLarge;
-        for (const auto& match : goodMatches) {
-            pointsSmall.push_back(keypointsSmall[match.queryIdx].pt);
-            pointsLarge.push_back(keypointsLarge[match.trainIdx].pt);
+        // FNV-1a over the template's rows, mixed with its geometry, type and the block size.
+        static uint64_t key(const cv::Mat& image, const cv::Size& block) {
+            uint64_t hash = 1469598103934665603ull;
+            const size_t rowBytes = image.cols * image.elemSize();
+            for (int y = 0; y < image.rows; ++y) {
+                const uchar* row = image.ptr<uchar>(y);
+                for (size_t i = 0; i < rowBytes; ++i) {
+                    hash = (hash ^ row[i]) * 1099511628211ull;
+                }
+            }
+            const uint64_t shape[] = { static_cast<uint64_t>(image.cols), static_cast<uint64_t>(image.rows),
+                static_cast<uint64_t>(image.type()), static_cast<uint64_t>(block.width), static_cast<uint64_t>(block.height) };
+            for (uint64_t value : shape) {
+                hash = (hash ^ value) * 1099511628211ull;
+            }
+            return hash;
         }
 
-        cv::Mat homography = cv::findHomography(pointsSmall, pointsLarge, cv::RANSAC);
+        std::shared_ptr<const FFTMatcher::Template> find(uint64_t key) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto cached = index_.find(key);
+            if (cached == index_.end()) {
+                return nullptr;
+            }
+            entries_.splice(entries_.begin(), entries_, cached->second);
+            return cached->second->templ;
+        }
 
-        if (homography.empty()) {
-            std::cerr << "Error: Homography computation failed.\n";
-            return cv::Rect(0, 0, 0, 0);
+        void insert(uint64_t key, std::shared_ptr<const FFTMatcher::Template> templ, const cv::Size& block) {
+            const size_t bytes = static_cast<size_t>(block.area()) * templ->channels() * sizeof(float);
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (bytes > budget_ || index_.find(key) != index_.end()) {
+                return;
+            }
+            entries_.push_front({ key, std::move(templ), bytes });
+            index_[key] = entries_.begin();
+            used_ += bytes;
+            while (used_ > budget_) {
+                used_ -= entries_.back().bytes;
+                index_.erase(entries_.back().key);
+                entries_.pop_back();
+            }
         }
 
-        std::vector<cv::Point2f> smallCorners = {
-            cv::Point2f(0, 0),
-            cv::Point2f(static_cast<float>(smallImage.cols), 0),
-            cv::Point2f(static_cast<float>(smallImage.cols), static_cast<float>(smallImage.rows)),
-            cv::Point2f(0, static_cast<float>(smallImage.rows))
+    private:
+        struct Entry {
+            uint64_t key;
+            std::shared_ptr<const FFTMatcher::Template> templ;
+            size_t bytes;
         };
 
-        std::vector<cv::Point2f> largeCorners(4);
-        cv::perspectiveTransform(smallCorners, largeCorners, homography);
+        explicit FFTTemplateCache(size_t budget) : budget_(budget) {}
 
-        cv::Rect boundingRect = cv::boundingRect(largeCorners);
+        size_t budget_;
+        size_t used_ = 0;
+        std::mutex mutex_;
+        std::list<Entry> entries_;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    };
 
-        if (boundingRect.width <= 0 || boundingRect.height <= 0 ||
-            boundingRect.x < 0 || boundingRect.y < 0 ||
-            boundingRect.x + boundingRect.width > largeImage.cols ||
-            boundingRect.y + boundingRect.height > largeImage.rows) {
-            return cv::Rect(0, 0, 0, 0);
-        }
-        if (!isAspectRatioClose(boundingRect, smallImage, 0.2)) {
-            return cv::Rect(0, 0, 0, 0);
+    // Finds the best match of each small image in the large one. Templates large enough for the FFT
+    // path are cached by content (see FFTTemplateCache), so repeated searches for the same images in
+    // frames of the same size skip the template transforms; the first call for a template pays the
+    // full cost, so one-shot searches do not benefit. Code that searches a fixed set of templates on
+    // every frame should keep its own FFTMatcher and FFTMatcher::Template objects instead.
+    static std::vector<cv::Rect> findImagesInImage(const cv::Mat& largeImage, const std::vector<cv::Mat>& smallImages, double scale = 1.0, bool grayscale = false) {
+        if (scale <= 0.0 || scale > 1.0) {
+            throw std::invalid_argument("Scale must be between 0 and 1.");
         }
-        return boundingRect;
-    }
 
-    static void computeKeypointsAndDescriptors(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) {
-        int imageArea = image.cols * image.rows;
+        cv::Mat largeCopy;
+        if (scale != 1.0) {
+            cv::resize(largeImage, largeCopy, cv::Size(), scale, scale);
+        }
+        else {
+            largeCopy = largeImage;
+        }
+        if (grayscale) {
+            cv::cvtColor(largeCopy, largeCopy, cv::COLOR_BGR2GRAY);
+        }
 
-        int limit = std::clamp(static_cast<int>(imageArea * 0.005), 500, INT_MAX);
+        std::vector<cv::Mat> smallCopies(smallImages.size());
+        int maxTemplateSide = 0;
+        for (size_t i = 0; i < smallImages.size(); ++i) {
+            if (scale != 1.0) {
+                cv::resize(smallImages[i], smallCopies[i], cv::Size(), scale, scale);
+            }
+            else {
+                smallCopies[i] = smallImages[i];
+            }
+            if (grayscale) {
+                cv::cvtColor(smallCopies[i], smallCopies[i], cv::COLOR_BGR2GRAY);
+            }
+            if (smallCopies[i].total() >= kFFTMinTemplateArea) {
+                maxTemplateSide = std::max({ maxTemplateSide, smallCopies[i].cols, smallCopies[i].rows });
+            }
+        }
 
-        cv::Ptr<cv::ORB> orb = cv::ORB::create(limit);
+        FFTMatcher matcher(maxTemplateSide);
+        if (maxTemplateSide > 0) {
+            matcher.setFrame(largeCopy);
+        }
 
-        orb->detectAndCompute(image, cv::noArray(), keypoints, descriptors);
+        std::vector<cv::Rect> rects;
+        rects.reserve(smallCopies.size());
+        for (const cv::Mat& smallCopy : smallCopies) {
+            cv::Rect matchRect;
+            if (smallCopy.total() >= kFFTMinTemplateArea) {
+                const uint64_t key = FFTTemplateCache::key(smallCopy, matcher.blockSize());
+                std::shared_ptr<const FFTMatcher::Template> templ = FFTTemplateCache::instance().find(key);
+                if (templ) {
+                    matchRect = matcher.find(*templ);
+                }
+                else {
+                    templ = std::make_shared<const FFTMatcher::Template>(smallCopy);
+                    matchRect = matcher.find(*templ);
+                    FFTTemplateCache::instance().insert(key, templ, matcher.blockSize());
+                }
+            }
+            else {
+                cv::Mat result;
+                cv::matchTemplate(largeCopy, smallCopy, result, cv::TM_CCOEFF_NORMED);
+                cv::Point maxLoc;
+                cv::minMaxLoc(result, nullptr, nullptr, nullptr, &maxLoc);
+                matchRect = cv::Rect(maxLoc.x, maxLoc.y, smallCopy.cols, smallCopy.rows);
+            }
+            rects.push_back(unscaleRect(matchRect, scale, largeImage.size()));
+        }
+        return rects;
     }
 
-    static cv::Mat convertToGrayScale(const cv::Mat& inputImage) {
-        if (inputImage.empty()) {
-            std::cerr << "Error: Input image is empty.\n";
-            return inputImage;
+    // Exhaustive sum-of-absolute-differences search for small icons. Common template sizes and
+    // channel counts run a kernel specialised at compile time; others use the generic kernel. The
+    // score is 1 - SAD / (255 * template bytes).
+    static Result<cv::Rect> findIconInImage(const cv::Mat& largeImage, const cv::Mat& smallImage, double minScore = 0.9) {
+        if (largeImage.empty() || smallImage.empty()) {
+            return Result<cv::Rect>::failure(ErrorCode::EmptyImage);
+        }
+        if (largeImage.type() != smallImage.type() || largeImage.depth() != CV_8U) {
+            throw std::invalid_argument("Icon search needs 8-bit images of the same type.");
+        }
+        if (smallImage.cols > largeImage.cols || smallImage.rows > largeImage.rows) {
+            return Result<cv::Rect>::failure(ErrorCode::OutOfBounds);
         }
 
-        cv::Mat grayImage;
-        cv::cvtColor(inputImage, grayImage, cv::COLOR_BGR2GRAY);
+        IconKernel kernel = selectIconKernel(smallImage.cols, smallImage.rows, smallImage.channels());
+        const int searchRows = largeImage.rows - smallImage.rows + 1;
 
-        return grayImage;
+        std::mutex bestMutex;
+        uint64_t bestSad = UINT64_MAX;
+        cv::Point bestLoc;
+        cv::parallel_for_(cv::Range(0, searchRows), [&](const cv::Range& range) {
+            uint64_t sad = UINT64_MAX;
+            cv::Point loc = kernel(largeImage, smallImage, range.start, range.end, sad);
+            std::lock_guard<std::mutex> lock(bestMutex);
+            if (sad < bestSad || (sad == bestSad && (loc.y < bestLoc.y || (loc.y == bestLoc.y && loc.x < bestLoc.x)))) {
+                bestSad = sad;
+                bestLoc = loc;
+            }
+        });
+
+        double score = 1.0 - static_cast<double>(bestSad) / (255.0 * smallImage.total() * smallImage.channels());
+        if (score < minScore) {
+            return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, score);
+        }
+        return Result<cv::Rect>(cv::Rect(bestLoc, smallImage.size()), score);
     }
 
-    bool findPixelColor(const cv::Mat& image, const cv::Vec3b& targetColor, int tolerance = 0) {
-        if (image.empty()) {
-            throw std::invalid_argument("The image is empty.");
+    // Reads short strings such as HUD counters by matching binarised glyph bitmaps. The ROI is
+    // binarised with Otsu (the minority side is taken as ink), split on empty columns, and each
+    // piece is scaled to every glyph's size and scored by Hamming distance of the packed bits.
+    // Pieces wider than any glyph are split greedily. Results are cached by ROI content.
+    class GlyphReader {
+    public:
+        explicit GlyphReader(double minScore = 0.8, size_t cacheSize = 64)
+            : minScore_(minScore), cacheSize_(cacheSize) {}
+
+        void addGlyph(char symbol, const cv::Mat& image) {
+            if (image.empty()) {
+                throw std::invalid_argument("Glyph image is empty.");
+            }
+            cv::Mat ink = binarize(grayView(image));
+            cv::Rect bounds = cv::boundingRect(ink);
+            if (bounds.empty()) {
+                throw std::invalid_argument("Glyph image has no ink.");
+            }
+            Glyph glyph;
+            glyph.symbol = symbol;
+            glyph.size = bounds.size();
+            glyph.bits = pack(ink(bounds));
+            glyphs_.push_back(std::move(glyph));
+            maxWidth_ = std::max(maxWidth_, bounds.width);
+            totalWidth_ += bounds.width;
+            clearCache();
         }
-        for (int y = 0; y < image.rows; ++y) {
-            for (int x = 0; x < image.cols; ++x) {
-                const cv::Vec3b& pixel = image.at<cv::Vec3b>(y, x);
-                if (std::abs(pixel[0] - targetColor[0]) <= tolerance &&
-                    std::abs(pixel[1] - targetColor[1]) <= tolerance &&
-                    std::abs(pixel[2] - targetColor[2]) <= tolerance) {
-                    return true; 
+
+        // Loads every image in directory; the first character of the file stem is the symbol.
+        void loadDirectory(const std::string& directory) {
+            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+                std::string stem = entry.path().stem().string();
+                cv::Mat image = cv::imread(entry.path().string(), cv::IMREAD_GRAYSCALE);
+                if (!stem.empty() && !image.empty()) {
+                    addGlyph(stem[0], image);
                 }
             }
         }
-        return false;
-    }
 
-    #ifdef _WIN32
-    static HBITMAP CaptureScreen(int x = 0, int y = 0, int width = GetSystemMetrics(SM_CXSCREEN), int height = GetSystemMetrics(SM_CYSCREEN)) {
-        HDC hScreenDC = GetDC(NULL);
-        HDC hMemoryDC = CreateCompatibleDC(hScreenDC);
+        // The score is the lowest per-glyph similarity in the string.
+        Result<std::string> read(const cv::Mat& image, const cv::Rect& roi) {
+            Result<cv::Mat> area = tryGetRegionOfInterest(image, roi);
+            if (!area.ok()) {
+                return Result<std::string>::failure(area.error());
+            }
+            return read(*area);
+        }
 
-        HBITMAP hBitmap = CreateCompatibleBitmap(hScreenDC, width, height);
-        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+        Result<std::string> read(const cv::Mat& region) {
+            if (region.empty()) {
+                return Result<std::string>::failure(ErrorCode::EmptyImage);
+            }
+            if (glyphs_.empty()) {
+                return Result<std::string>::failure(ErrorCode::NoMatches);
+            }
+            const uint64_t key = contentHash(region);
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex_);
+                auto cached = cacheIndex_.find(key);
+                if (cached != cacheIndex_.end()) {
+                    cache_.splice(cache_.begin(), cache_, cached->second);
+                    return cached->second->second;
+                }
+            }
+            Result<std::string> text = recognise(binarize(grayView(region)));
+            {
+                std::lock_guard<std::mutex> lock(cacheMutex_);
+                if (cacheIndex_.find(key) == cacheIndex_.end() && cacheSize_ > 0) {
+                    cache_.emplace_front(key, text);
+                    cacheIndex_[key] = cache_.begin();
+                    if (cache_.size() > cacheSize_) {
+                        cacheIndex_.erase(cache_.back().first);
+                        cache_.pop_back();
+                    }
+                }
+            }
+            return text;
+        }
 
-        BitBlt(hMemoryDC, 0, 0, width, height, hScreenDC, x, y, SRCCOPY);
+        size_t glyphCount() const { return glyphs_.size(); }
 
-        SelectObject(hMemoryDC, hOldBitmap);
+    private:
+        struct Glyph {
+            char symbol;
+            cv::Size size;
+            std::vector<uchar> bits;
+        };
 
-        DeleteDC(hMemoryDC);
-        ReleaseDC(NULL, hScreenDC);
+        struct Match {
+            char symbol;
+            int width;
+            double score;
+        };
 
-        return hBitmap;
-    }
+        Result<std::string> recognise(const cv::Mat& ink) const {
+            std::string text;
+            double worst = 1.0;
+            const double spaceWidth = 0.6 * totalWidth_ / static_cast<double>(glyphs_.size());
+            std::vector<uchar> columns(ink.cols, 0);
+            for (int y = 0; y < ink.rows; ++y) {
+                const uchar* row = ink.ptr<uchar>(y);
+                for (int x = 0; x < ink.cols; ++x) {
+                    columns[x] |= row[x];
+                }
+            }
+            int x = 0, lastEnd = -1;
+            while (x < ink.cols) {
+                if (!columns[x]) {
+                    ++x;
+                    continue;
+                }
+                int end = x;
+                while (end < ink.cols && columns[end]) {
+                    ++end;
+                }
+                if (lastEnd >= 0 && x - lastEnd > spaceWidth) {
+                    text += ' ';
+                }
+                for (int start = x; start < end;) {
+                    Match match = best(ink.colRange(start, end));
+                    text += match.symbol;
+                    worst = std::min(worst, match.score);
+                    start += std::max(match.width, 1);
+                }
+                lastEnd = end;
+                x = end;
+            }
+            if (text.empty()) {
+                return Result<std::string>::failure(ErrorCode::NoMatches);
+            }
+            if (worst < minScore_) {
+                return Result<std::string>::failure(ErrorCode::BelowThreshold, worst);
+            }
+            return Result<std::string>(text, worst);
+        }
 
-    static HBITMAP CaptureWindow(HWND hwnd) {
-        HDC hWindowDC = GetWindowDC(hwnd);
-        RECT rc;
-        GetWindowRect(hwnd, &rc);
-        int width = rc.right - rc.left;
-        int height = rc.bottom - rc.top;
+        // Best glyph for the start of a column run. Runs no wider than the widest glyph are
+        // matched whole; wider runs are matched glyph-width by glyph-width.
+        Match best(const cv::Mat& run) const {
+            Match result{ '?', run.cols, -1.0 };
+            for (const Glyph& glyph : glyphs_) {
+                int width = run.cols <= maxWidth_ ? run.cols : std::min(glyph.size.width, run.cols);
+                cv::Mat piece = run.colRange(0, width);
+                cv::Rect bounds = cv::boundingRect(piece);
+                if (bounds.empty()) {
+                    continue;
+                }
+                cv::Mat scaled;
+                cv::resize(piece(bounds), scaled, glyph.size, 0, 0, cv::INTER_NEAREST);
+                std::vector<uchar> bits = pack(scaled);
+                const double total = static_cast<double>(glyph.size.area());
+                double score = 1.0 - hammingDistance(bits.data(), glyph.bits.data(), static_cast<int>(bits.size())) / total;
+                if (score > result.score) {
+                    result = Match{ glyph.symbol, width, score };
+                }
+            }
+            return result;
+        }
 
-        HDC hMemoryDC = CreateCompatibleDC(hWindowDC);
-        HBITMAP hBitmap = CreateCompatibleBitmap(hWindowDC, width, height);
-        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+        static cv::Mat binarize(const cv::Mat& gray) {
+            cv::Mat ink;
+            double level = cv::threshold(gray, ink, 0, 1, cv::THRESH_BINARY | cv::THRESH_OTSU);
+            if (static_cast<size_t>(cv::countNonZero(ink)) * 2 > ink.total()) {
+                cv::threshold(gray, ink, level, 1, cv::THRESH_BINARY_INV);
+            }
+            return ink;
+        }
 
-        if (!PrintWindow(hwnd, hMemoryDC, PW_RENDERFULLCONTENT)) {
-            BitBlt(hMemoryDC, 0, 0, width, height, hWindowDC, 0, 0, SRCCOPY);
+        static std::vector<uchar> pack(const cv::Mat& ink) {
+            std::vector<uchar> bits((ink.total() + 7) / 8, 0);
+            size_t i = 0;
+            for (int y = 0; y < ink.rows; ++y) {
+                const uchar* row = ink.ptr<uchar>(y);
+                for (int x = 0; x < ink.cols; ++x, ++i) {
+                    if (row[x]) {
+                        bits[i >> 3] |= static_cast<uchar>(1u << (i & 7));
+                    }
+                }
+            }
+            return bits;
         }
 
-        SelectObject(hMemoryDC, hOldBitmap);
-        DeleteDC(hMemoryDC);
-        ReleaseDC(hwnd, hWindowDC);
+        // FNV-1a over the region's rows.
+        static uint64_t contentHash(const cv::Mat& region) {
+            uint64_t hash = 1469598103934665603ull;
+            const size_t rowBytes = region.cols * region.elemSize();
+            for (int y = 0; y < region.rows; ++y) {
+                const uchar* row = region.ptr<uchar>(y);
+                for (size_t i = 0; i < rowBytes; ++i) {
+                    hash = (hash ^ row[i]) * 1099511628211ull;
+                }
+            }
+            return hash ^ (static_cast<uint64_t>(region.cols) << 32) ^ static_cast<uint64_t>(region.rows);
+        }
 
-        return hBitmap;
-    }
+        void clearCache() {
+            std::lock_guard<std::mutex> lock(cacheMutex_);
+            cache_.clear();
+            cacheIndex_.clear();
+        }
 
-    static HWND FindWindowByTitle(const std::wstring& title) {
-        return FindWindow(NULL, title.c_str());
-    }
+        double minScore_;
+        size_t cacheSize_;
+        std::vector<Glyph> glyphs_;
+        int maxWidth_ = 0;
+        int totalWidth_ = 0;
 
-    static cv::Mat HBitmapToMat(HBITMAP hBitmap) {
-        BITMAP bmp;
-        GetObject(hBitmap, sizeof(BITMAP), &bmp);
-        int width = bmp.bmWidth;
-        int height = bmp.bmHeight;
+        std::mutex cacheMutex_;
+        std::list<std::pair<uint64_t, Result<std::string>>> cache_;
+        std::unordered_map<uint64_t, std::list<std::pair<uint64_t, Result<std::string>>>::iterator> cacheIndex_;
+    };
 
-        HDC hMemoryDC = CreateCompatibleDC(NULL);
-        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+    // Detector settings for computeKeypointsAndDescriptors. The default matches cv::ORB::create with a
+    // feature budget scaled by image area.
+    struct ORBProfile {
+        int maxFeatures;
+        float scaleFactor;
+        int levels;
+        int edgeThreshold;
+        int patchSize;
+        int fastThreshold;
+        cv::ORB::ScoreType scoreType;
+        bool upright;
 
-        cv::Mat mat(height, width, CV_8UC4); 
+        ORBProfile()
+            : maxFeatures(0), scaleFactor(1.2f), levels(8), edgeThreshold(31), patchSize(31),
+            fastThreshold(20), scoreType(cv::ORB::HARRIS_SCORE), upright(false) {}
 
-        BITMAPINFO bi = { 0 };
-        bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-        bi.bmiHeader.biWidth = width;
-        bi.bmiHeader.biHeight = -height; 
-        bi.bmiHeader.biPlanes = 1;
-        bi.bmiHeader.biBitCount = 32;
-        bi.bmiHeader.biCompression = BI_RGB;
+        // Screen content is never rotated and appears at a known size. Orientation is skipped, the
+        // pyramid only spans the relative scale range the template may appear at, and the FAST
+        // threshold is raised so anti-aliasing and gradients do not yield corners.
+        static ORBProfile screen(const cv::Size& templateSize, double scale = 1.0,
+            double minRelativeScale = 1.0, double maxRelativeScale = 1.0) {
+            if (minRelativeScale <= 0.0 || maxRelativeScale < minRelativeScale) {
+                throw std::invalid_argument("Relative scale range must be positive and ordered.");
+            }
+            ORBProfile profile;
+            profile.upright = true;
+            profile.scoreType = cv::ORB::FAST_SCORE;
+            profile.fastThreshold = 40;
 
-        GetDIBits(hMemoryDC, hBitmap, 0, height, mat.data, &bi, DIB_RGB_COLORS);
+            int minSide = static_cast<int>(std::min(templateSize.width, templateSize.height) * scale);
+            profile.patchSize = std::clamp(minSide / 3, 11, 31);
+            profile.edgeThreshold = profile.patchSize;
 
-        SelectObject(hMemoryDC, hOldBitmap);
-        DeleteDC(hMemoryDC);
+            double range = std::log(maxRelativeScale / minRelativeScale) / std::log(profile.scaleFactor);
+            int wanted = 1 + static_cast<int>(std::ceil(range - 1e-9));
+            int fitting = 1;
+            double side = minSide;
+            while (side / profile.scaleFactor >= 2.0 * profile.patchSize) {
+                side /= profile.scaleFactor;
+                ++fitting;
+            }
+            profile.levels = std::max(1, std::min(wanted, fitting));
+            return profile;
+        }
+    };
 
-        return mat;
+    static cv::Rect findImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage, int minMatchScore = 230, double scale = 1.0, bool debug = false) {
+        return findImageInImageORB(largeImage, smallImage, ORBProfile(), minMatchScore, scale, debug);
     }
 
-    static void ClickAtPosition(int x, int y) {
-        INPUT inputs[2] = {};
-        
-        inputs[0].type = INPUT_MOUSE;
-        inputs[0].mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
-        inputs[0].mi.dx = (LONG)x;
-        inputs[0].mi.dy = (LONG)y;
-        inputs[0].mi.dwExtraInfo = 0;
+    static cv::Rect findImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage, const ORBProfile& profile, int minMatchScore = 230, double scale = 1.0, bool debug = false) {
+        return valueOrLog(tryFindImageInImageORB(largeImage, smallImage, profile, minMatchScore, scale, debug),
+            cv::Rect(0, 0, 0, 0), "findImageInImageORB");
+    }
 
-        inputs[1].type = INPUT_MOUSE;
-        inputs[1].mi.dwFlags = MOUSEEVENTF_LEFTUP;
-        inputs[1].mi.dx = (LONG)x;
-        inputs[1].mi.dy = (LONG)y;
-        inputs[1].mi.dwExtraInfo = 0;
+    static cv::Rect findImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage,
+        const std::vector<cv::KeyPoint>& keypointsLarge, const cv::Mat& descriptorsLarge,
+        const std::vector<cv::KeyPoint>& keypointsSmall, const cv::Mat& descriptorsSmall,
+        int minMatchScore = 230, bool debug = false) {
+        return valueOrLog(tryFindImageInImageORB(largeImage, smallImage, keypointsLarge, descriptorsLarge,
+            keypointsSmall, descriptorsSmall, minMatchScore, debug), cv::Rect(0, 0, 0, 0), "findImageInImageORB");
+    }
+
+    // The score of ORB results is the number of descriptor matches that passed the distance filter.
+    static Result<cv::Rect> tryFindImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage, int minMatchScore = 230, double scale = 1.0, bool debug = false) {
+        return tryFindImageInImageORB(largeImage, smallImage, ORBProfile(), minMatchScore, scale, debug);
+    }
 
+    static Result<cv::Rect> tryFindImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage, const ORBProfile& profile, int minMatchScore = 230, double scale = 1.0, bool debug = false) {
+        if (scale <= 0.0 || scale > 1.0) {
+            throw std::invalid_argument("Scale must be between 0 and 1.");
+        }
         
-        SetCursorPos(x, y);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        SendInput(2, inputs, sizeof(INPUT));
+        minMatchScore = std::clamp(minMatchScore, 0, 256);
+
+        cv::Mat largeCopy, smallCopy;
+
+        if (scale != 1.0) {
+            cv::resize(largeImage, largeCopy, cv::Size(), scale, scale);
+            cv::resize(smallImage, smallCopy, cv::Size(), scale, scale);
+        }
+        else {
+            largeCopy = largeImage;
+            smallCopy = smallImage;
+        }
+
+        return matchORB(largeCopy, smallCopy, profile, minMatchScore, debug, nullptr);
     }
 
-    cv::Mat ResourceToMat(int resourceID, const std::string& resourceType) {
-        HRSRC hResource = FindResource(NULL, MAKEINTRESOURCE(resourceID), resourceType.c_str());
-        if (hResource == NULL) {
-            return cv::Mat();
+    static Result<cv::Rect> tryFindImageInImageORB(const cv::Mat& largeImage, const cv::Mat& smallImage,
+        const std::vector<cv::KeyPoint>& keypointsLarge, const cv::Mat& descriptorsLarge,
+        const std::vector<cv::KeyPoint>& keypointsSmall, const cv::Mat& descriptorsSmall,
+        int minMatchScore = 230, bool debug = false) {
+        
+        minMatchScore = std::clamp(minMatchScore, 0, 256);
+
+        if (descriptorsLarge.empty() || descriptorsSmall.empty()) {
+            return Result<cv::Rect>::failure(ErrorCode::NoDescriptors);
         }
 
-        HGLOBAL hLoadedResource = LoadResource(NULL, hResource);
-        if (hLoadedResource == NULL) {
-            return cv::Mat();
+        Result<cv::Mat> homography = estimateHomographyORB(largeImage, smallImage, keypointsLarge, descriptorsLarge,
+            keypointsSmall, descriptorsSmall, minMatchScore, debug);
+
+        if (!homography) {
+            return Result<cv::Rect>::failure(homography.error(), homography.score());
         }
 
-        DWORD dwResourceSize = SizeofResource(NULL, hResource);
-        const void* pResourceData = LockResource(hLoadedResource);
+        cv::Rect boundingRect = projectedBounds(*homography, smallImage.size());
 
-        std::vector<uchar> buffer((uchar*)pResourceData, (uchar*)pResourceData + dwResourceSize);
-        cv::Mat image = cv::imdecode(buffer, cv::IMREAD_COLOR);
-        return image;
+        if (boundingRect.width <= 0 || boundingRect.height <= 0 ||
+            boundingRect.x < 0 || boundingRect.y < 0 ||
+            boundingRect.x + boundingRect.width > largeImage.cols ||
+            boundingRect.y + boundingRect.height > largeImage.rows) {
+            return Result<cv::Rect>::failure(ErrorCode::OutOfBounds, homography.score());
+        }
+        if (!isAspectRatioClose(boundingRect, smallImage, 0.2)) {
+            return Result<cv::Rect>::failure(ErrorCode::AspectMismatch, homography.score());
+        }
+        return Result<cv::Rect>(boundingRect, homography.score());
     }
 
-    #elif __APPLE__
-    /*CGImageRef CaptureScreen(int x = 0, int y = 0, int width = CGDisplayPixelsWide(kCGDirectMainDisplay), int height = CGDisplayPixelsHigh(kCGDirectMainDisplay)) {
-        CGRect captureRect = CGRectMake(x, y, width, height);
-        return CGWindowListCreateImage(captureRect, kCGWindowListOptionOnScreenOnly, kCGNullWindowID, kCGWindowImageDefault);
+    // ORB localisation followed by a single-window NCC check of the candidate against the template.
+    // The rect is in largeImage coordinates and the score is the NCC score, also on BelowThreshold.
+    static Result<cv::Rect> findImageInImageORBVerified(const cv::Mat& largeImage, const cv::Mat& smallImage, double minScore = 0.8, int minMatchScore = 230, double scale = 1.0) {
+        return findImageInImageORBVerified(largeImage, smallImage, ORBProfile(), minScore, minMatchScore, scale);
     }
 
-    CGImageRef CaptureWindow(CGWindowID windowID) {
-        CGImageRef image = CGWindowListCreateImage(
-            CGRectNull,
-            kCGWindowListOptionOnScreenOnly,
-            windowID,
-            kCGWindowImageDefault
-        );
-        
-        if (!image) {
-            throw std::runtime_error("Failed to capture window.");
+    static Result<cv::Rect> findImageInImageORBVerified(const cv::Mat& largeImage, const cv::Mat& smallImage, const ORBProfile& profile, double minScore = 0.8, int minMatchScore = 230, double scale = 1.0) {
+        if (scale <= 0.0 || scale > 1.0) {
+            throw std::invalid_argument("Scale must be between 0 and 1.");
         }
-        return image;
+
+        minMatchScore = std::clamp(minMatchScore, 0, 256);
+
+        cv::Mat largeCopy, smallCopy;
+
+        if (scale != 1.0) {
+            cv::resize(largeImage, largeCopy, cv::Size(), scale, scale);
+            cv::resize(smallImage, smallCopy, cv::Size(), scale, scale);
+        }
+        else {
+            largeCopy = largeImage;
+            smallCopy = smallImage;
+        }
+
+        cv::Mat homography;
+        Result<cv::Rect> candidate = matchORB(largeCopy, smallCopy, profile, minMatchScore, false, &homography);
+        if (!candidate) {
+            return candidate;
+        }
+
+        double score = verifyHomography(largeCopy, smallCopy, homography);
+        if (score < minScore) {
+            return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, score);
+        }
+        return Result<cv::Rect>(unscaleRect(*candidate, scale, largeImage.size()), score);
     }
 
-    static CGWindowID FindWindowByTitle(const std::string& title) {
-        uint32_t windowListSize;
-        CFArrayRef windowList = CGWindowListCopyWindowInfo(kCGWindowListOptionAll, kCGNullWindowID);
-        CFIndex count = CFArrayGetCount(windowList);
-        for (CFIndex i = 0; i < count; ++i) {
-            CFDictionaryRef windowInfo = (CFDictionaryRef)CFArrayGetValueAtIndex(windowList, i);
-            CFStringRef windowTitleRef = (CFStringRef)CFDictionaryGetValue(windowInfo, kCGWindowName);
-            if (windowTitleRef) {
-                char windowTitle[256];
-                if (CFStringGetCString(windowTitleRef, windowTitle, sizeof(windowTitle), kCFStringEncodingUTF8)) {
-                    if (title == windowTitle) {
-                        CFRelease(windowList);
-                        return (CGWindowID)CFDictionaryGetValue(windowInfo, CFSTR("kCGWindowID"));
-                    }
-                }
-            }
+    // TM_CCOEFF_NORMED score of the template against the region the homography maps it onto. Near
+    // translations are cropped directly; anything else is warped back to the template frame.
+    static double verifyHomography(const cv::Mat& largeImage, const cv::Mat& smallImage, const cv::Mat& homography) {
+        cv::Mat h;
+        homography.convertTo(h, CV_64F);
+        h = h / h.at<double>(2, 2);
+
+        const double eps = 1e-2;
+        bool translation = std::abs(h.at<double>(0, 0) - 1.0) < eps && std::abs(h.at<double>(1, 1) - 1.0) < eps &&
+            std::abs(h.at<double>(0, 1)) < eps && std::abs(h.at<double>(1, 0)) < eps &&
+            std::abs(h.at<double>(2, 0)) < 1e-5 && std::abs(h.at<double>(2, 1)) < 1e-5;
+
+        cv::Mat candidate;
+        cv::Rect crop(cvRound(h.at<double>(0, 2)), cvRound(h.at<double>(1, 2)), smallImage.cols, smallImage.rows);
+        if (translation && (crop & cv::Rect(0, 0, largeImage.cols, largeImage.rows)) == crop) {
+            candidate = largeImage(crop);
+        }
+        else {
+            cv::warpPerspective(largeImage, candidate, h, smallImage.size(), cv::INTER_LINEAR | cv::WARP_INVERSE_MAP);
+        }
+
+        cv::Mat templ = smallImage;
+        if (candidate.channels() != templ.channels()) {
+            candidate = grayView(candidate);
+            templ = grayView(templ);
+        }
+
+        cv::Mat result;
+        cv::matchTemplate(candidate, templ, result, cv::TM_CCOEFF_NORMED);
+        return result.at<float>(0, 0);
+    }
+
+    static void computeKeypointsAndDescriptors(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors) {
+        computeKeypointsAndDescriptors(image, keypoints, descriptors, ORBProfile());
+    }
+
+    static void computeKeypointsAndDescriptors(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::Mat& descriptors, const ORBProfile& profile) {
+        int imageArea = image.cols * image.rows;
+
+        int limit = profile.maxFeatures > 0 ? profile.maxFeatures : std::clamp(static_cast<int>(imageArea * 0.005), 500, INT_MAX);
+
+        cv::Ptr<cv::ORB> orb = cv::ORB::create(limit, profile.scaleFactor, profile.levels, profile.edgeThreshold,
+            0, 2, profile.scoreType, profile.patchSize, profile.fastThreshold);
+
+        if (!profile.upright) {
+            orb->detectAndCompute(image, cv::noArray(), keypoints, descriptors);
+            return;
+        }
+
+        // ORB keeps the angle and octave of provided keypoints, so FAST corners with angle 0 yield
+        // upright descriptors without the intensity-centroid pass.
+        detectUprightKeypoints(grayView(image), profile, limit, keypoints);
+        orb->compute(image, keypoints, descriptors);
+    }
+
+    // Follows an object located by findImageInImageORB with pyramidal Lucas-Kanade flow on a few
+    // dozen corners, so full ORB detection only runs again once the track degrades.
+    class ObjectTracker {
+    public:
+        struct Params {
+            int maxPoints = 48;
+            double qualityLevel = 0.01;
+            double minDistance = 4.0;
+            cv::Size window = cv::Size(15, 15);
+            int pyramidLevels = 3;
+            float maxForwardBackwardError = 1.0f;
+            double ransacThreshold = 2.0;
+            double minQuality = 0.5;
+            int minPoints = 6;
+        };
+
+        ObjectTracker() = default;
+        explicit ObjectTracker(const Params& params) : params_(params) {}
+
+        bool init(const cv::Mat& frame, const cv::Rect& rect) {
+            reset();
+            cv::Rect bounded = rect & cv::Rect(0, 0, frame.cols, frame.rows);
+            if (frame.empty() || bounded.area() <= 0) {
+                return false;
+            }
+
+            cv::Mat gray = grayView(frame);
+            cv::Mat mask = cv::Mat::zeros(gray.size(), CV_8UC1);
+            mask(bounded).setTo(cv::Scalar(255));
+            cv::goodFeaturesToTrack(gray, points_, params_.maxPoints, params_.qualityLevel, params_.minDistance, mask);
+            if (static_cast<int>(points_.size()) < params_.minPoints) {
+                points_.clear();
+                return false;
+            }
+
+            cv::buildOpticalFlowPyramid(gray, prevPyramid_, params_.window, params_.pyramidLevels);
+            rect_ = cv::Rect2f(static_cast<float>(bounded.x), static_cast<float>(bounded.y),
+                static_cast<float>(bounded.width), static_cast<float>(bounded.height));
+            seededCount_ = points_.size();
+            quality_ = 1.0;
+            tracking_ = true;
+            return true;
+        }
+
+        bool update(const cv::Mat& frame) {
+            if (!tracking_ || frame.empty()) {
+                return false;
+            }
+
+            std::vector<cv::Mat> pyramid;
+            cv::buildOpticalFlowPyramid(grayView(frame), pyramid, params_.window, params_.pyramidLevels);
+
+            std::vector<cv::Point2f> forward, backward;
+            std::vector<uchar> forwardStatus, backwardStatus;
+            std::vector<float> error;
+            cv::calcOpticalFlowPyrLK(prevPyramid_, pyramid, points_, forward, forwardStatus, error,
+                params_.window, params_.pyramidLevels);
+            cv::calcOpticalFlowPyrLK(pyramid, prevPyramid_, forward, backward, backwardStatus, error,
+                params_.window, params_.pyramidLevels);
+
+            std::vector<cv::Point2f> from, to;
+            const cv::Rect2f bounds(0.0f, 0.0f, static_cast<float>(frame.cols), static_cast<float>(frame.rows));
+            for (size_t i = 0; i < points_.size(); ++i) {
+                if (!forwardStatus[i] || !backwardStatus[i] || !bounds.contains(forward[i])) {
+                    continue;
+                }
+                if (cv::norm(backward[i] - points_[i]) > params_.maxForwardBackwardError) {
+                    continue;
+                }
+                from.push_back(points_[i]);
+                to.push_back(forward[i]);
+            }
+
+            if (static_cast<int>(from.size()) < params_.minPoints) {
+                return lose();
+            }
+
+            std::vector<uchar> inliers;
+            cv::Mat similarity = cv::estimateAffinePartial2D(from, to, inliers, cv::RANSAC, params_.ransacThreshold);
+            if (similarity.empty()) {
+                return lose();
+            }
+
+            std::vector<cv::Point2f> kept;
+            for (size_t i = 0; i < to.size(); ++i) {
+                if (inliers[i]) {
+                    kept.push_back(to[i]);
+                }
+            }
+            quality_ = static_cast<double>(kept.size()) / static_cast<double>(seededCount_);
+            if (static_cast<int>(kept.size()) < params_.minPoints || quality_ < params_.minQuality) {
+                return lose();
+            }
+
+            std::vector<cv::Point2f> corners = {
+                rect_.tl(),
+                cv::Point2f(rect_.x + rect_.width, rect_.y),
+                rect_.br(),
+                cv::Point2f(rect_.x, rect_.y + rect_.height)
+            };
+            cv::transform(corners, corners, similarity);
+            cv::Point2f low = corners[0], high = corners[0];
+            for (const cv::Point2f& corner : corners) {
+                low.x = std::min(low.x, corner.x);
+                low.y = std::min(low.y, corner.y);
+                high.x = std::max(high.x, corner.x);
+                high.y = std::max(high.y, corner.y);
+            }
+            // cv::boundingRect would round outwards and grow the box every frame.
+            rect_ = cv::Rect2f(low, high);
+
+            points_ = std::move(kept);
+            prevPyramid_ = std::move(pyramid);
+            return true;
+        }
+
+        // Tracks while the track is healthy and falls back to ORB re-detection when it is lost.
+        cv::Rect track(const cv::Mat& frame, const cv::Mat& templateImage, int minMatchScore = 230, double scale = 1.0) {
+            if (update(frame)) {
+                return rect();
+            }
+            Result<cv::Rect> found = tryFindImageInImageORB(frame, templateImage, minMatchScore, scale);
+            if (found && init(frame, unscaleRect(*found, scale, frame.size()))) {
+                return rect();
+            }
+            return cv::Rect(0, 0, 0, 0);
+        }
+
+        void reset() {
+            tracking_ = false;
+            quality_ = 0.0;
+            seededCount_ = 0;
+            points_.clear();
+            prevPyramid_.clear();
+        }
+
+        bool isTracking() const { return tracking_; }
+        double quality() const { return quality_; }
+        const std::vector<cv::Point2f>& points() const { return points_; }
+
+        cv::Rect rect() const {
+            return cv::Rect(cvRound(rect_.x), cvRound(rect_.y), cvRound(rect_.width), cvRound(rect_.height));
+        }
+
+    private:
+        bool lose() {
+            tracking_ = false;
+            return false;
+        }
+
+        Params params_;
+        std::vector<cv::Mat> prevPyramid_;
+        std::vector<cv::Point2f> points_;
+        cv::Rect2f rect_;
+        size_t seededCount_ = 0;
+        double quality_ = 0.0;
+        bool tracking_ = false;
+    };
+
+    // Chooses search resolution per template so the searches of one frame fit a time budget.
+    // Each report feeds an exponential average of latency and of the score margin; scale follows
+    // the square root of the budget/latency ratio, since cost grows with area, but is not
+    // lowered while the margin sits below minMargin. ORB searches also get a pyramid depth and a
+    // feature budget that shrink with scale.
+    class QualityController {
+    public:
+        struct Settings {
+            double scale;
+            int pyramidLevels;
+            int maxFeatures;
+        };
+
+        explicit QualityController(double frameBudgetMs = 16.0, double minScale = 0.25, double maxScale = 1.0,
+            double minMargin = 0.25, int maxFeatures = 1000)
+            : frameBudgetMs_(frameBudgetMs), minScale_(minScale), maxScale_(maxScale),
+            minMargin_(minMargin), maxFeatures_(maxFeatures) {
+            if (frameBudgetMs <= 0.0 || minScale <= 0.0 || maxScale < minScale || maxScale > 1.0) {
+                throw std::invalid_argument("Budget must be positive and 0 < minScale <= maxScale <= 1.");
+            }
+        }
+
+        Settings settings(const std::string& key) {
+            return derive(state(key).scale);
+        }
+
+        // Margin is the normalised distance of the score above acceptance; negative on a miss.
+        void report(const std::string& key, double latencyMs, double margin) {
+            State& entry = state(key);
+            const double alpha = 0.2;
+            entry.latencyMs = entry.samples == 0 ? latencyMs : entry.latencyMs + alpha * (latencyMs - entry.latencyMs);
+            entry.margin = entry.samples == 0 ? margin : entry.margin + alpha * (margin - entry.margin);
+            ++entry.samples;
+
+            const double budget = frameBudgetMs_ / static_cast<double>(states_.size());
+            double factor = std::sqrt(budget / std::max(entry.latencyMs, 1e-3));
+            if (entry.margin < minMargin_) {
+                factor = std::max(factor, entry.latencyMs > 1.5 * budget ? 1.0 : 1.1);
+            }
+            factor = std::clamp(factor, 0.8, 1.1);
+            entry.scale = std::clamp(entry.scale * factor, minScale_, maxScale_);
+        }
+
+        Result<cv::Rect> find(const std::string& key, const cv::Mat& largeImage, const cv::Mat& smallImage,
+            double minScore = 0.8, bool grayscale = false) {
+            Settings current = settings(key);
+            auto start = std::chrono::steady_clock::now();
+            Result<cv::Rect> found = tryFindImageInImage(largeImage, smallImage, current.scale, grayscale);
+            report(key, elapsedMs(start), (found.score() - minScore) / std::max(1.0 - minScore, 1e-6));
+            if (found.ok() && found.score() < minScore) {
+                return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, found.score());
+            }
+            return found;
+        }
+
+        // ORB search with the controller's scale, pyramid depth and feature budget applied to
+        // profile. The margin is the share of good matches beyond the four a homography needs.
+        Result<cv::Rect> findORB(const std::string& key, const cv::Mat& largeImage, const cv::Mat& smallImage,
+            int minMatchScore = 230) {
+            return findORB(key, largeImage, smallImage, ORBProfile(), minMatchScore);
+        }
+
+        Result<cv::Rect> findORB(const std::string& key, const cv::Mat& largeImage, const cv::Mat& smallImage,
+            const ORBProfile& profile, int minMatchScore = 230) {
+            Settings current = settings(key);
+            ORBProfile tuned = profile;
+            tuned.levels = std::min(profile.levels, current.pyramidLevels);
+            tuned.maxFeatures = profile.maxFeatures > 0 ? std::min(profile.maxFeatures, current.maxFeatures) : current.maxFeatures;
+
+            auto start = std::chrono::steady_clock::now();
+            Result<cv::Rect> found = tryFindImageInImageORB(largeImage, smallImage, tuned, minMatchScore, current.scale);
+            double margin = found.score() > 0.0 ? 1.0 - 4.0 / found.score() : -1.0;
+            report(key, elapsedMs(start), found.ok() ? margin : std::min(margin, -0.1));
+            if (!found.ok()) {
+                return found;
+            }
+            return Result<cv::Rect>(unscaleRect(*found, current.scale, largeImage.size()), found.score());
+        }
+
+    private:
+        struct State {
+            double scale;
+            double latencyMs;
+            double margin;
+            int samples;
+        };
+
+        State& state(const std::string& key) {
+            auto it = states_.find(key);
+            if (it == states_.end()) {
+                it = states_.emplace(key, State{ maxScale_, 0.0, 1.0, 0 }).first;
+            }
+            return it->second;
+        }
+
+        Settings derive(double scale) const {
+            Settings result;
+            result.scale = scale;
+            double span = std::log(scale / minScale_) / std::log(1.2);
+            result.pyramidLevels = std::clamp(1 + static_cast<int>(std::round(span)), 1, 8);
+            result.maxFeatures = std::max(100, static_cast<int>(maxFeatures_ * scale * scale / (maxScale_ * maxScale_)));
+            return result;
+        }
+
+        static double elapsedMs(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        double frameBudgetMs_;
+        double minScale_;
+        double maxScale_;
+        double minMargin_;
+        int maxFeatures_;
+        std::unordered_map<std::string, State> states_;
+    };
+
+    static cv::Mat convertToGrayScale(const cv::Mat& inputImage) {
+        return valueOrLog(tryConvertToGrayScale(inputImage), inputImage, "convertToGrayScale");
+    }
+
+    static Result<cv::Mat> tryConvertToGrayScale(const cv::Mat& inputImage) {
+        if (inputImage.empty()) {
+            return Result<cv::Mat>::failure(ErrorCode::EmptyImage);
+        }
+
+        cv::Mat grayImage;
+        cv::cvtColor(inputImage, grayImage, cv::COLOR_BGR2GRAY);
+
+        return grayImage;
+    }
+
+    bool findPixelColor(const cv::Mat& image, const cv::Vec3b& targetColor, int tolerance = 0) {
+        if (image.empty()) {
+            throw std::invalid_argument("The image is empty.");
+        }
+        return locatePixelColor(image, targetColor, tolerance).ok();
+    }
+
+    // First pixel in row-major order whose B, G and R all lie within tolerance of targetColor.
+    // Accepts BGR and BGRA images; alpha is ignored.
+    static Result<cv::Point> locatePixelColor(const cv::Mat& image, const cv::Vec3b& targetColor, int tolerance = 0) {
+        if (image.empty()) {
+            return Result<cv::Point>::failure(ErrorCode::EmptyImage);
+        }
+        if (image.depth() != CV_8U || image.channels() < 3) {
+            throw std::invalid_argument("Colour search needs a BGR or BGRA image.");
+        }
+        const ColourRowFn scan = colourRowKernel();
+        const uchar colour[3] = { targetColor[0], targetColor[1], targetColor[2] };
+        tolerance = std::clamp(tolerance, 0, 255);
+        for (int y = 0; y < image.rows; ++y) {
+            int x = scan(image.ptr<uchar>(y), image.cols, image.channels(), colour, tolerance, true);
+            if (x >= 0) {
+                return cv::Point(x, y);
+            }
+        }
+        return Result<cv::Point>::failure(ErrorCode::BelowThreshold);
+    }
+
+    struct Blob {
+        cv::Rect bounds;
+        int area;
+        cv::Point2d centroid;
+    };
+
+    // Connected regions (8-connected) of pixels within tolerance of targetColor, found in one
+    // pass without a mask: the colour kernel finds both ends of each matching run, runs
+    // overlapping a run of the previous row are joined with union-find, and area, bounds and
+    // centroid sums are accumulated at the roots as they merge. A root is marked oversized as
+    // soon as its area passes maxArea and accumulates nothing further; its runs are still joined
+    // so the whole region is dropped. minArea can only be judged once a region is complete, so it
+    // is applied in the final sweep. Blobs are returned in the order their first pixel was met;
+    // bounds and centroids are in image coordinates.
+    static std::vector<Blob> findColourBlobs(const cv::Mat& image, const cv::Vec3b& targetColor, int tolerance = 0,
+        int minArea = 1, int maxArea = INT_MAX, const cv::Rect& roi = cv::Rect()) {
+        if (image.empty()) {
+            throw std::invalid_argument("The image is empty.");
+        }
+        if (image.depth() != CV_8U || image.channels() < 3) {
+            throw std::invalid_argument("Colour search needs a BGR or BGRA image.");
+        }
+        const cv::Rect area = roi.empty() ? cv::Rect(0, 0, image.cols, image.rows) : (roi & cv::Rect(0, 0, image.cols, image.rows));
+        const ColourRowFn scan = colourRowKernel();
+        const uchar colour[3] = { targetColor[0], targetColor[1], targetColor[2] };
+        tolerance = std::clamp(tolerance, 0, 255);
+        const int cn = image.channels();
+
+        struct Run {
+            int start, end;
+        };
+        std::vector<int> parent;
+        std::vector<Blob> stats;
+        std::vector<double> sumX, sumY;
+        std::vector<char> oversized;
+        auto find = [&](int i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        };
+        auto unite = [&](int a, int b) {
+            a = find(a);
+            b = find(b);
+            if (a == b) {
+                return;
+            }
+            if (a > b) {
+                std::swap(a, b);
+            }
+            parent[b] = a;
+            if (oversized[a] || oversized[b] || stats[a].area > maxArea - stats[b].area) {
+                oversized[a] = true;
+                return;
+            }
+            stats[a].bounds |= stats[b].bounds;
+            stats[a].area += stats[b].area;
+            sumX[a] += sumX[b];
+            sumY[a] += sumY[b];
+        };
+
+        std::vector<Run> previous, current;
+        int previousFirst = 0;
+        for (int y = area.y; y < area.y + area.height; ++y) {
+            const uchar* row = image.ptr<uchar>(y) + area.x * cn;
+            current.clear();
+            const int currentFirst = static_cast<int>(parent.size());
+            for (int x = 0; x < area.width;) {
+                int hit = scan(row + x * cn, area.width - x, cn, colour, tolerance, true);
+                if (hit < 0) {
+                    break;
+                }
+                const int start = x + hit;
+                const int miss = scan(row + (start + 1) * cn, area.width - start - 1, cn, colour, tolerance, false);
+                const int end = miss < 0 ? area.width : start + 1 + miss;
+                const int length = end - start;
+                const int id = static_cast<int>(parent.size());
+                parent.push_back(id);
+                stats.push_back({ cv::Rect(area.x + start, y, length, 1), length, cv::Point2d() });
+                sumX.push_back(length * (area.x + (start + end - 1) / 2.0));
+                sumY.push_back(static_cast<double>(length) * y);
+                oversized.push_back(length > maxArea);
+                current.push_back({ start, end });
+                x = end;
+            }
+
+            // Both run lists are sorted, so one merge walk finds all overlaps (diagonals included).
+            size_t p = 0;
+            for (size_t c = 0; c < current.size(); ++c) {
+                while (p < previous.size() && previous[p].end < current[c].start) {
+                    ++p;
+                }
+                for (size_t q = p; q < previous.size() && previous[q].start <= current[c].end; ++q) {
+                    unite(currentFirst + static_cast<int>(c), previousFirst + static_cast<int>(q));
+                }
+            }
+            std::swap(previous, current);
+            previousFirst = currentFirst;
+        }
+
+        std::vector<Blob> blobs;
+        for (int i = 0; i < static_cast<int>(parent.size()); ++i) {
+            if (parent[i] == i && !oversized[i] && stats[i].area >= minArea) {
+                Blob blob = stats[i];
+                blob.centroid = cv::Point2d(sumX[i] / blob.area, sumY[i] / blob.area);
+                blobs.push_back(blob);
+            }
+        }
+        return blobs;
+    }
+
+    static unsigned hammingDistance(const uchar* a, const uchar* b, int bytes) {
+        static const HammingFn distance = CpuDispatch::Kernel<HammingFn>{
+            &hammingBaseline, IP_AVX2_KERNEL(hammingPopcnt), nullptr }.select();
+        return distance(a, b, bytes);
+    }
+
+    // Describes a health or progress bar for readGauge. Pixels within tolerance of fillColour
+    // count as filled and those within tolerance of emptyColour as empty; anything else (borders,
+    // text drawn over the bar) is ignored.
+    struct GaugeSpec {
+        enum class Orientation { LeftToRight, RightToLeft, BottomToTop, TopToBottom };
+
+        Orientation orientation;
+        cv::Vec3b fillColour;
+        cv::Vec3b emptyColour;
+        int tolerance;
+        int scanLines;
+
+        GaugeSpec(const cv::Vec3b& fill, const cv::Vec3b& empty, Orientation direction = Orientation::LeftToRight,
+            int colourTolerance = 40, int lines = 3)
+            : orientation(direction), fillColour(fill), emptyColour(empty), tolerance(colourTolerance), scanLines(lines) {}
+    };
+
+    // Fill fraction of a bar in [0, 1], read from a few evenly spaced scan lines instead of the
+    // whole area. Each line is run-length encoded into fill/empty runs and split where the fewest
+    // pixels disagree; the pixel at the split is interpolated between the two colours for a
+    // sub-pixel edge. The result is the median over lines and the score is the share of
+    // classified pixels that agree with it.
+    static Result<double> readGauge(const cv::Mat& image, const cv::Rect& roi, const GaugeSpec& spec) {
+        Result<cv::Mat> area = tryGetRegionOfInterest(image, roi);
+        if (!area.ok()) {
+            return Result<double>::failure(area.error());
+        }
+        if (area->depth() != CV_8U || area->channels() < 3) {
+            throw std::invalid_argument("Gauges need a BGR or BGRA image.");
+        }
+
+        const bool vertical = spec.orientation == GaugeSpec::Orientation::BottomToTop ||
+            spec.orientation == GaugeSpec::Orientation::TopToBottom;
+        const bool reversed = spec.orientation == GaugeSpec::Orientation::RightToLeft ||
+            spec.orientation == GaugeSpec::Orientation::BottomToTop;
+        const int length = vertical ? area->rows : area->cols;
+        const int across = vertical ? area->cols : area->rows;
+        const int lines = std::clamp(spec.scanLines, 1, across);
+        const int cn = area->channels();
+
+        std::vector<double> fractions;
+        int agreeing = 0, classified = 0;
+        std::vector<const uchar*> pixels(length);
+        for (int line = 0; line < lines; ++line) {
+            const int offset = (2 * line + 1) * across / (2 * lines);
+            for (int i = 0; i < length; ++i) {
+                int along = reversed ? length - 1 - i : i;
+                pixels[i] = vertical ? area->ptr<uchar>(along) + offset * cn : area->ptr<uchar>(offset) + along * cn;
+            }
+            int agree = 0, total = 0;
+            double edge;
+            if (gaugeEdge(pixels, spec, edge, agree, total)) {
+                fractions.push_back(edge / length);
+                agreeing += agree;
+                classified += total;
+            }
+        }
+        if (fractions.empty()) {
+            return Result<double>::failure(ErrorCode::BelowThreshold);
+        }
+        std::nth_element(fractions.begin(), fractions.begin() + fractions.size() / 2, fractions.end());
+        return Result<double>(std::clamp(fractions[fractions.size() / 2], 0.0, 1.0),
+            static_cast<double>(agreeing) / classified);
+    }
+
+    // Per-tile change map between two frames, used where no damage information is available.
+    struct DirtyTileMap {
+        cv::Size frameSize;
+        int tileSize = 0;
+        cv::Size grid;
+        std::vector<uchar> tiles;
+        std::vector<cv::Rect> rects;
+
+        bool any() const { return !rects.empty(); }
+
+        bool isDirty(int tileX, int tileY) const {
+            return tiles[static_cast<size_t>(tileY) * grid.width + tileX] != 0;
+        }
+
+        int dirtyCount() const {
+            return static_cast<int>(std::count(tiles.begin(), tiles.end(), uchar(1)));
+        }
+
+        bool intersects(const cv::Rect& roi) const {
+            cv::Rect bounded = roi & cv::Rect(cv::Point(0, 0), frameSize);
+            if (bounded.empty() || tileSize <= 0) {
+                return false;
+            }
+            for (int ty = bounded.y / tileSize; ty <= (bounded.y + bounded.height - 1) / tileSize; ++ty) {
+                for (int tx = bounded.x / tileSize; tx <= (bounded.x + bounded.width - 1) / tileSize; ++tx) {
+                    if (isDirty(tx, ty)) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+    };
+
+    // Compares two frames tile by tile, stopping at the first differing row of each tile. A channel
+    // difference above tolerance marks the tile dirty. An empty or differently sized previous frame
+    // marks everything dirty.
+    static DirtyTileMap diffFrames(const cv::Mat& previous, const cv::Mat& current, int tileSize = 32, int tolerance = 0) {
+        if (current.empty()) {
+            throw std::invalid_argument("The current frame is empty.");
+        }
+        if (tileSize <= 0) {
+            throw std::invalid_argument("Tile size must be positive.");
+        }
+        if (current.depth() != CV_8U) {
+            throw std::invalid_argument("Frames must be 8-bit.");
+        }
+
+        DirtyTileMap map;
+        map.frameSize = current.size();
+        map.tileSize = tileSize;
+        map.grid = cv::Size((current.cols + tileSize - 1) / tileSize, (current.rows + tileSize - 1) / tileSize);
+
+        bool comparable = previous.size() == current.size() && previous.type() == current.type();
+        map.tiles.assign(static_cast<size_t>(map.grid.area()), comparable ? 0 : 1);
+
+        if (comparable) {
+            const int cn = current.channels();
+            tolerance = std::clamp(tolerance, 0, 255);
+            cv::parallel_for_(cv::Range(0, map.grid.height), [&](const cv::Range& range) {
+                for (int ty = range.start; ty < range.end; ++ty) {
+                    const int y0 = ty * tileSize;
+                    const int y1 = std::min(y0 + tileSize, current.rows);
+                    for (int tx = 0; tx < map.grid.width; ++tx) {
+                        const int x0 = tx * tileSize * cn;
+                        const int bytes = (std::min((tx + 1) * tileSize, current.cols) - tx * tileSize) * cn;
+                        for (int y = y0; y < y1; ++y) {
+                            if (rowDiffers(previous.ptr<uchar>(y) + x0, current.ptr<uchar>(y) + x0, bytes, tolerance)) {
+                                map.tiles[static_cast<size_t>(ty) * map.grid.width + tx] = 1;
+                                break;
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        map.rects = mergeDirtyTiles(map);
+        return map;
+    }
+
+    class Preprocessor;
+
+    // Derived data for one frame, each product computed at most once by whichever thread asks
+    // first. Consumer calls record which products were used so Preprocessor can learn what to
+    // compute ahead of time for the next frame.
+    class FrameProducts {
+    public:
+        struct Features {
+            std::vector<cv::KeyPoint> keypoints;
+            cv::Mat descriptors;
+        };
+
+        enum Product : uint32_t { Gray = 1, Pyramid = 2, Integral = 4, RegionFeatures = 8 };
+
+        FrameProducts(const cv::Mat& image, uint64_t index, int pyramidLevels)
+            : image_(image), index_(index), pyramidLevels_(std::max(pyramidLevels, 1)), usage_(std::make_shared<Usage>()) {}
+
+        const cv::Mat& image() const { return image_; }
+        uint64_t index() const { return index_; }
+
+        const cv::Mat& gray() { usage_->used |= Gray; return computeGray(); }
+        const std::vector<cv::Mat>& pyramid() { usage_->used |= Pyramid; return computePyramid(); }
+
+        // CV_64F sum and squared-sum integrals of the gray image.
+        const cv::Mat& integral() { usage_->used |= Integral; return computeIntegral().first; }
+        const cv::Mat& squaredIntegral() { usage_->used |= Integral; return computeIntegral().second; }
+
+        // ORB features inside region, in frame coordinates.
+        const Features& features(const cv::Rect& region) {
+            usage_->used |= RegionFeatures;
+            {
+                std::lock_guard<std::mutex> lock(usage_->mutex);
+                if (std::find(usage_->requested.begin(), usage_->requested.end(), region) == usage_->requested.end()) {
+                    usage_->requested.push_back(region);
+                }
+            }
+            return computeFeatures(region);
+        }
+
+        uint32_t used() const { return usage_->used.load(); }
+
+        std::vector<cv::Rect> requestedRegions() const {
+            std::lock_guard<std::mutex> lock(usage_->mutex);
+            return usage_->requested;
+        }
+
+    private:
+        friend class Preprocessor;
+
+        // Kept apart from the products so Preprocessor can still read what a frame used after
+        // the caller has released it.
+        struct Usage {
+            std::atomic<uint32_t> used{ 0 };
+            std::mutex mutex;
+            std::vector<cv::Rect> requested;
+        };
+
+        struct FeatureSlot {
+            std::once_flag once;
+            Features features;
+        };
+
+        const cv::Mat& computeGray() {
+            std::call_once(grayOnce_, [this] { gray_ = grayView(image_); });
+            return gray_;
+        }
+
+        const std::vector<cv::Mat>& computePyramid() {
+            std::call_once(pyramidOnce_, [this] { cv::buildPyramid(computeGray(), pyramid_, pyramidLevels_ - 1); });
+            return pyramid_;
+        }
+
+        const std::pair<cv::Mat, cv::Mat>& computeIntegral() {
+            std::call_once(integralOnce_, [this] { cv::integral(computeGray(), integral_.first, integral_.second, CV_64F, CV_64F); });
+            return integral_;
+        }
+
+        const Features& computeFeatures(const cv::Rect& region) {
+            FeatureSlot* slot;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                std::unique_ptr<FeatureSlot>& entry = features_[{ region.x, region.y, region.width, region.height }];
+                if (!entry) {
+                    entry.reset(new FeatureSlot());
+                }
+                slot = entry.get();
+            }
+            std::call_once(slot->once, [&] {
+                cv::Rect area = region & cv::Rect(0, 0, image_.cols, image_.rows);
+                if (area.empty()) {
+                    return;
+                }
+                computeKeypointsAndDescriptors(computeGray()(area), slot->features.keypoints, slot->features.descriptors);
+                for (cv::KeyPoint& keypoint : slot->features.keypoints) {
+                    keypoint.pt += cv::Point2f(static_cast<float>(area.x), static_cast<float>(area.y));
+                }
+            });
+            return slot->features;
+        }
+
+        cv::Mat image_;
+        uint64_t index_;
+        int pyramidLevels_;
+        std::shared_ptr<Usage> usage_;
+
+        std::once_flag grayOnce_, pyramidOnce_, integralOnce_;
+        cv::Mat gray_;
+        std::vector<cv::Mat> pyramid_;
+        std::pair<cv::Mat, cv::Mat> integral_;
+
+        std::mutex mutex_;
+        std::map<std::array<int, 4>, std::unique_ptr<FeatureSlot>> features_;
+    };
+
+    // Hands each captured frame to a small worker pool that computes, ahead of demand, the
+    // products that recent frames actually consumed. Usage is tracked as a moving average per
+    // product and ORB regions stay hot for a few frames after their last request. Work for a frame
+    // is dropped once a newer frame has been submitted. submit() belongs to the capture thread.
+    class Preprocessor {
+    public:
+        explicit Preprocessor(int workers = 2, int pyramidLevels = 3, double threshold = 0.5)
+            : pyramidLevels_(pyramidLevels), threshold_(threshold) {
+            for (int i = 0; i < std::max(workers, 1); ++i) {
+                workers_.emplace_back([this] { work(); });
+            }
+        }
+
+        ~Preprocessor() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            for (std::thread& worker : workers_) {
+                worker.join();
+            }
+        }
+
+        Preprocessor(const Preprocessor&) = delete;
+        Preprocessor& operator=(const Preprocessor&) = delete;
+
+        std::shared_ptr<FrameProducts> submit(const cv::Mat& frame) {
+            learn();
+            auto products = std::make_shared<FrameProducts>(frame, ++latest_, pyramidLevels_);
+            std::vector<std::function<void()>> jobs;
+            std::weak_ptr<FrameProducts> weak = products;
+            if (usage_[0] >= threshold_ || usage_[1] >= threshold_ || usage_[2] >= threshold_) {
+                jobs.push_back([weak] { if (auto p = weak.lock()) p->computeGray(); });
+            }
+            if (usage_[1] >= threshold_) {
+                jobs.push_back([weak] { if (auto p = weak.lock()) p->computePyramid(); });
+            }
+            if (usage_[2] >= threshold_) {
+                jobs.push_back([weak] { if (auto p = weak.lock()) p->computeIntegral(); });
+            }
+            for (const auto& region : hotRegions_) {
+                cv::Rect rect = region.first;
+                jobs.push_back([weak, rect] { if (auto p = weak.lock()) p->computeFeatures(rect); });
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                jobs_.clear();
+                for (auto& job : jobs) {
+                    jobs_.push_back({ products->index(), std::move(job) });
+                }
+            }
+            wake_.notify_all();
+            previous_ = products->usage_;
+            return products;
+        }
+
+    private:
+        struct Job {
+            uint64_t frame;
+            std::function<void()> run;
+        };
+
+        void learn() {
+            if (!previous_) {
+                return;
+            }
+            const uint32_t used = previous_->used.load();
+            const uint32_t kinds[3] = { FrameProducts::Gray, FrameProducts::Pyramid, FrameProducts::Integral };
+            for (int i = 0; i < 3; ++i) {
+                usage_[i] += 0.25 * (((used & kinds[i]) ? 1.0 : 0.0) - usage_[i]);
+            }
+            for (auto it = hotRegions_.begin(); it != hotRegions_.end();) {
+                it = --it->second <= 0 ? hotRegions_.erase(it) : std::next(it);
+            }
+            std::vector<cv::Rect> requested;
+            {
+                std::lock_guard<std::mutex> lock(previous_->mutex);
+                requested = previous_->requested;
+            }
+            for (const cv::Rect& region : requested) {
+                auto it = std::find_if(hotRegions_.begin(), hotRegions_.end(),
+                    [&](const std::pair<cv::Rect, int>& hot) { return hot.first == region; });
+                if (it == hotRegions_.end()) {
+                    hotRegions_.push_back({ region, kHotFrames });
+                }
+                else {
+                    it->second = kHotFrames;
+                }
+            }
+        }
+
+        void work() {
+            for (;;) {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                    if (stopping_) {
+                        return;
+                    }
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
+                }
+                if (job.frame == latest_.load()) {
+                    job.run();
+                }
+            }
+        }
+
+        static constexpr int kHotFrames = 8;
+
+        int pyramidLevels_;
+        double threshold_;
+        std::array<double, 3> usage_ = { 0.0, 0.0, 0.0 };
+        std::vector<std::pair<cv::Rect, int>> hotRegions_;
+        std::shared_ptr<FrameProducts::Usage> previous_;
+        std::atomic<uint64_t> latest_{ 0 };
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<Job> jobs_;
+        bool stopping_ = false;
+        std::vector<std::thread> workers_;
+    };
+
+    // Mean and variance of any rectangle in constant time, per channel, from integral images
+    // built on first use. Built from FrameProducts it works on the gray image and shares the
+    // integrals the preprocessor may already have computed. With a palette set, dominant() also
+    // answers which palette colour covers most of a rectangle, via one count integral per entry.
+    class RegionStats {
+    public:
+        struct Stats {
+            cv::Scalar mean;
+            cv::Scalar variance;
+            int count;
+        };
+
+        explicit RegionStats(const cv::Mat& image) : image_(image) {
+            if (image.empty()) {
+                throw std::invalid_argument("The image is empty.");
+            }
+        }
+
+        explicit RegionStats(const std::shared_ptr<FrameProducts>& products)
+            : image_(products->gray()), products_(products) {}
+
+        Stats stats(const cv::Rect& rect) {
+            build();
+            cv::Rect area = rect & cv::Rect(0, 0, image_.cols, image_.rows);
+            Stats result{ cv::Scalar::all(0), cv::Scalar::all(0), area.area() };
+            if (area.empty()) {
+                return result;
+            }
+            const int cn = image_.channels();
+            const double n = area.area();
+            for (int c = 0; c < cn && c < 4; ++c) {
+                double sum = boxSum(sum_, area, cn, c);
+                double sq = boxSum(sqsum_, area, cn, c);
+                result.mean[c] = sum / n;
+                result.variance[c] = std::max(0.0, sq / n - result.mean[c] * result.mean[c]);
+            }
+            return result;
+        }
+
+        std::vector<Stats> stats(const std::vector<cv::Rect>& rects) {
+            build();
+            std::vector<Stats> results(rects.size());
+            cv::parallel_for_(cv::Range(0, static_cast<int>(rects.size())), [&](const cv::Range& range) {
+                for (int i = range.start; i < range.end; ++i) {
+                    results[i] = stats(rects[i]);
+                }
+            });
+            return results;
+        }
+
+        // Every pixel is assigned to its nearest palette colour (L1 distance over BGR).
+        void setPalette(std::vector<cv::Vec3b> palette) {
+            if (image_.channels() < 3) {
+                throw std::invalid_argument("A palette needs a BGR or BGRA image.");
+            }
+            std::lock_guard<std::mutex> lock(paletteMutex_);
+            palette_ = std::move(palette);
+            counts_.clear();
+        }
+
+        // Index of the palette colour covering most of rect; the score is its share of the area.
+        Result<int> dominant(const cv::Rect& rect) {
+            const std::vector<cv::Mat>& counts = buildCounts();
+            cv::Rect area = rect & cv::Rect(0, 0, image_.cols, image_.rows);
+            if (counts.empty()) {
+                return Result<int>::failure(ErrorCode::NoMatches);
+            }
+            if (area.empty()) {
+                return Result<int>::failure(ErrorCode::InvalidROI);
+            }
+            int best = 0;
+            int bestCount = -1;
+            for (int i = 0; i < static_cast<int>(counts.size()); ++i) {
+                const cv::Mat& count = counts[i];
+                int n = count.at<int>(area.y + area.height, area.x + area.width) - count.at<int>(area.y, area.x + area.width) -
+                    count.at<int>(area.y + area.height, area.x) + count.at<int>(area.y, area.x);
+                if (n > bestCount) {
+                    bestCount = n;
+                    best = i;
+                }
+            }
+            return Result<int>(best, static_cast<double>(bestCount) / area.area());
+        }
+
+    private:
+        void build() {
+            std::call_once(built_, [this] {
+                if (products_) {
+                    sum_ = products_->integral();
+                    sqsum_ = products_->squaredIntegral();
+                }
+                else {
+                    cv::integral(image_, sum_, sqsum_, CV_64F, CV_64F);
+                }
+            });
+        }
+
+        const std::vector<cv::Mat>& buildCounts() {
+            std::lock_guard<std::mutex> lock(paletteMutex_);
+            if (!counts_.empty() || palette_.empty()) {
+                return counts_;
+            }
+            const int cn = image_.channels();
+            std::vector<cv::Mat> masks(palette_.size());
+            for (cv::Mat& mask : masks) {
+                mask = cv::Mat::zeros(image_.size(), CV_8U);
+            }
+            for (int y = 0; y < image_.rows; ++y) {
+                const uchar* row = image_.ptr<uchar>(y);
+                for (int x = 0; x < image_.cols; ++x, row += cn) {
+                    int nearest = 0, nearestDistance = INT_MAX;
+                    for (int i = 0; i < static_cast<int>(palette_.size()); ++i) {
+                        int d = std::abs(row[0] - palette_[i][0]) + std::abs(row[1] - palette_[i][1]) + std::abs(row[2] - palette_[i][2]);
+                        if (d < nearestDistance) {
+                            nearestDistance = d;
+                            nearest = i;
+                        }
+                    }
+                    masks[nearest].at<uchar>(y, x) = 1;
+                }
+            }
+            counts_.resize(palette_.size());
+            for (size_t i = 0; i < masks.size(); ++i) {
+                cv::integral(masks[i], counts_[i], CV_32S);
+            }
+            return counts_;
+        }
+
+        static double boxSum(const cv::Mat& integral, const cv::Rect& area, int cn, int c) {
+            const double* top = integral.ptr<double>(area.y);
+            const double* bottom = integral.ptr<double>(area.y + area.height);
+            const int left = area.x * cn + c;
+            const int right = (area.x + area.width) * cn + c;
+            return bottom[right] - bottom[left] - top[right] + top[left];
+        }
+
+        cv::Mat image_;
+        std::shared_ptr<FrameProducts> products_;
+        std::once_flag built_;
+        cv::Mat sum_, sqsum_;
+
+        std::mutex paletteMutex_;
+        std::vector<cv::Vec3b> palette_;
+        std::vector<cv::Mat> counts_;
+    };
+
+    // One captured screen state together with what changed since the previous one.
+    struct Frame {
+        cv::Mat image;
+        uint64_t index = 0;
+        std::chrono::steady_clock::time_point timestamp;
+        std::vector<cv::Rect> damage;
+        bool fullDamage = false;
+
+        // An empty roi stands for the whole frame.
+        bool intersects(const cv::Rect& roi) const {
+            if (fullDamage) {
+                return true;
+            }
+            for (const cv::Rect& rect : damage) {
+                if (roi.empty() || !(rect & roi).empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // Produces frames only when the screen changes. next() blocks until there is new damage or the
+    // deadline passes, and returns false on timeout; frame() is the latest captured state.
+    class FrameSource {
+    public:
+        virtual ~FrameSource() = default;
+        virtual bool next(std::chrono::steady_clock::time_point deadline) = 0;
+        const Frame& frame() const { return frame_; }
+
+        // File descriptor that becomes readable when damage may be pending, or -1 if the source
+        // can only be polled.
+        virtual int fd() const { return -1; }
+
+        // True when events have already been read off fd() into a user-space queue; fd() will not
+        // become readable for them, so waiting on it would stall.
+        virtual bool pending() const { return false; }
+
+    protected:
+        void publish(const cv::Mat& image, std::vector<cv::Rect> damage, bool fullDamage) {
+            frame_.image = image;
+            frame_.index += 1;
+            frame_.timestamp = std::chrono::steady_clock::now();
+            frame_.damage = std::move(damage);
+            frame_.fullDamage = fullDamage;
+        }
+
+        Frame frame_;
+    };
+
+    // Fallback for platforms without damage events: grabs at a fixed interval and reports only
+    // the tiles that differ from the previous grab.
+    class PollingFrameSource : public FrameSource {
+    public:
+        explicit PollingFrameSource(std::function<cv::Mat()> grab,
+            std::chrono::milliseconds interval = std::chrono::milliseconds(16), int tileSize = 32)
+            : grab_(std::move(grab)), interval_(interval), tileSize_(tileSize) {}
+
+        bool next(std::chrono::steady_clock::time_point deadline) override {
+            for (;;) {
+                std::this_thread::sleep_until(std::min(lastGrab_ + interval_, deadline));
+                lastGrab_ = std::chrono::steady_clock::now();
+                cv::Mat image = grab_();
+                if (!image.empty()) {
+                    if (frame_.image.empty()) {
+                        publish(image, {}, true);
+                        return true;
+                    }
+                    DirtyTileMap dirty = diffFrames(frame_.image, image, tileSize_);
+                    if (dirty.any()) {
+                        publish(image, std::move(dirty.rects), false);
+                        return true;
+                    }
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    return false;
+                }
+            }
+        }
+
+    private:
+        std::function<cv::Mat()> grab_;
+        std::chrono::milliseconds interval_;
+        int tileSize_;
+        std::chrono::steady_clock::time_point lastGrab_;
+    };
+
+    // Spaces capture work at a target rate on the steady clock. Wake-ups follow an absolute
+    // schedule so sleep overshoot does not accumulate as drift; falling more than a period behind
+    // counts as an overrun and restarts the schedule from now instead of bursting to catch up.
+    // While frames keep arriving unchanged the interval stretches by 25% per frame up to
+    // maxIdleBackoff periods, and snaps back on the first change.
+    class FramePacer {
+    public:
+        struct Stats {
+            uint64_t frames = 0;
+            uint64_t overruns = 0;
+            double meanLatenessMs = 0.0;
+            double jitterMs = 0.0;
+            double maxLatenessMs = 0.0;
+            double backoff = 1.0;
+        };
+
+        explicit FramePacer(double targetFps = 20.0, double maxIdleBackoff = 4.0)
+            : maxBackoff_(std::max(maxIdleBackoff, 1.0)) {
+            setTargetFps(targetFps);
+        }
+
+        void setTargetFps(double fps) {
+            if (fps <= 0.0) {
+                throw std::invalid_argument("Target frame rate must be positive.");
+            }
+            period_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+        }
+
+        // Sleeps until the next slot. Returns false, after sleeping until deadline, when the slot
+        // lies beyond it.
+        bool wait(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max()) {
+            auto now = std::chrono::steady_clock::now();
+            if (next_ == std::chrono::steady_clock::time_point()) {
+                next_ = now;
+            }
+            if (next_ > deadline) {
+                std::this_thread::sleep_until(deadline);
+                return false;
+            }
+            std::this_thread::sleep_until(next_);
+            now = std::chrono::steady_clock::now();
+            record(std::chrono::duration<double, std::milli>(now - next_).count());
+
+            const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period_ * backoff_);
+            if (now - next_ > interval) {
+                ++stats_.overruns;
+                next_ = now + interval;
+            }
+            else {
+                next_ += interval;
+            }
+            return true;
+        }
+
+        // Reports whether the frame taken in this slot showed any change.
+        void frameDone(bool changed) {
+            backoff_ = changed ? 1.0 : std::min(backoff_ * 1.25, maxBackoff_);
+            stats_.backoff = backoff_;
+        }
+
+        Stats stats() const {
+            Stats result = stats_;
+            result.jitterMs = stats_.frames > 1 ? std::sqrt(latenessM2_ / (stats_.frames - 1)) : 0.0;
+            return result;
+        }
+
+        void resetStats() {
+            stats_ = Stats();
+            stats_.backoff = backoff_;
+            latenessM2_ = 0.0;
+        }
+
+    private:
+        void record(double latenessMs) {
+            ++stats_.frames;
+            double delta = latenessMs - stats_.meanLatenessMs;
+            stats_.meanLatenessMs += delta / static_cast<double>(stats_.frames);
+            latenessM2_ += delta * (latenessMs - stats_.meanLatenessMs);
+            stats_.maxLatenessMs = std::max(stats_.maxLatenessMs, latenessMs);
+        }
+
+        std::chrono::steady_clock::duration period_;
+        std::chrono::steady_clock::time_point next_;
+        double maxBackoff_;
+        double backoff_ = 1.0;
+        double latenessM2_ = 0.0;
+        Stats stats_;
+    };
+
+    // Puts a FramePacer in front of another source: the inner source is asked for a frame once
+    // per slot, and slots without damage lengthen the pacer's idle backoff.
+    class PacedFrameSource : public FrameSource {
+    public:
+        PacedFrameSource(FrameSource& inner, double targetFps = 20.0, double maxIdleBackoff = 4.0)
+            : inner_(inner), pacer_(targetFps, maxIdleBackoff) {}
+
+        bool next(std::chrono::steady_clock::time_point deadline) override {
+            while (pacer_.wait(deadline)) {
+                bool changed = inner_.next(std::chrono::steady_clock::now());
+                pacer_.frameDone(changed);
+                if (changed) {
+                    frame_ = inner_.frame();
+                    return true;
+                }
+                if (std::chrono::steady_clock::now() >= deadline) {
+                    break;
+                }
+            }
+            return false;
+        }
+
+        FramePacer& pacer() { return pacer_; }
+
+    private:
+        FrameSource& inner_;
+        FramePacer pacer_;
+    };
+
+    // A frame reduced to the tiles that changed, or to all tiles for a keyframe.
+    struct TileFrame {
+        uint64_t index = 0;
+        int64_t timestampUs = 0;
+        bool key = false;
+        cv::Size size;
+        int type = 0;
+        std::vector<std::pair<int, cv::Mat>> tiles;
+    };
+
+    // Writes captured frames to disk losslessly as tile deltas. record() runs on the capture
+    // thread and only diffs against the last accepted frame and copies the changed tiles; a
+    // background thread compresses them with a QOI-style tile codec and appends them to the file.
+    // Every keyframeInterval frames, and whenever the frame size or type changes, all tiles are
+    // written so a reader can seek. When queuing a frame would take the queue past maxQueuedBytes
+    // of tiles the frame is dropped, keyframes included, unless the queue is empty; the next one
+    // is diffed against the last frame actually queued, so the recording stays consistent.
+    class SessionRecorder {
+    public:
+        explicit SessionRecorder(const std::string& path, int tileSize = 64, int keyframeInterval = 120,
+            size_t maxQueuedBytes = size_t(64) << 20)
+            : tileSize_(tileSize), keyframeInterval_(std::max(keyframeInterval, 1)), maxQueuedBytes_(maxQueuedBytes),
+            out_(path, std::ios::binary | std::ios::trunc) {
+            if (tileSize <= 0) {
+                throw std::invalid_argument("Tile size must be positive.");
+            }
+            if (!out_) {
+                throw std::runtime_error("Cannot open recording file: " + path);
+            }
+            out_.write(kRecordingMagic, sizeof(kRecordingMagic));
+            writeValue(out_, static_cast<int32_t>(tileSize_));
+            worker_ = std::thread([this] { work(); });
+        }
+
+        ~SessionRecorder() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            worker_.join();
+        }
+
+        SessionRecorder(const SessionRecorder&) = delete;
+        SessionRecorder& operator=(const SessionRecorder&) = delete;
+
+        // Returns false when the frame was dropped because the queue is full. Frames identical to
+        // the previous one are still recorded, as records without tiles, to keep their timing.
+        bool record(const cv::Mat& frame) {
+            if (frame.empty()) {
+                return false;
+            }
+            const auto now = std::chrono::steady_clock::now();
+            TileFrame job;
+            job.key = previous_.empty() || previous_.size() != frame.size() || previous_.type() != frame.type() ||
+                sinceKeyframe_ >= keyframeInterval_;
+            job.size = frame.size();
+            job.type = frame.type();
+            job.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+            job.tiles = collectTiles(job.key ? cv::Mat() : previous_, frame, tileSize_);
+
+            const bool key = job.key;
+            size_t bytes = 0;
+            for (const auto& tile : job.tiles) {
+                bytes += tile.second.total() * tile.second.elemSize();
+            }
+            // Shares the tile data with the queued job; only the changed tiles reach previous_.
+            const std::vector<std::pair<int, cv::Mat>> tiles = job.tiles;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (queuedBytes_ > 0 && queuedBytes_ + bytes > maxQueuedBytes_) {
+                    ++dropped_;
+                    return false;
+                }
+                job.index = frames_++;
+                queuedBytes_ += bytes;
+                queue_.push_back(std::move(job));
+            }
+            wake_.notify_one();
+            sinceKeyframe_ = key ? 1 : sinceKeyframe_ + 1;
+            applyTiles(previous_, frame.size(), frame.type(), tiles, tileSize_);
+            return true;
+        }
+
+        uint64_t recorded() const { std::lock_guard<std::mutex> lock(mutex_); return frames_; }
+        uint64_t dropped() const { std::lock_guard<std::mutex> lock(mutex_); return dropped_; }
+        uint64_t bytesWritten() const { return written_.load(); }
+
+    private:
+        void work() {
+            for (;;) {
+                TileFrame job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+                    if (queue_.empty()) {
+                        out_.flush();
+                        return;
+                    }
+                    job = std::move(queue_.front());
+                    queue_.pop_front();
+                }
+                std::vector<uchar> payload = encodeTileFrame(job);
+                writeValue(out_, kFrameMagic);
+                writeValue(out_, static_cast<uint64_t>(payload.size()));
+                out_.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+                written_ += payload.size() + sizeof(uint32_t) + sizeof(uint64_t);
+
+                size_t bytes = 0;
+                for (const auto& tile : job.tiles) {
+                    bytes += tile.second.total() * tile.second.elemSize();
+                }
+                std::lock_guard<std::mutex> lock(mutex_);
+                queuedBytes_ -= bytes;
+            }
+        }
+
+        int tileSize_;
+        int keyframeInterval_;
+        size_t maxQueuedBytes_;
+        std::ofstream out_;
+
+        cv::Mat previous_;
+        int sinceKeyframe_ = 0;
+
+        mutable std::mutex mutex_;
+        std::condition_variable wake_;
+        std::deque<TileFrame> queue_;
+        size_t queuedBytes_ = 0;
+        uint64_t frames_ = 0;
+        uint64_t dropped_ = 0;
+        bool stopping_ = false;
+        std::atomic<uint64_t> written_{ 0 };
+        std::thread worker_;
+    };
+
+    // Random access to a SessionRecorder file. Opening indexes the frame records without
+    // decoding them; frame(n) decodes from the nearest keyframe at or before n, or continues from
+    // the last decoded frame when that is closer. As a FrameSource it replays the recording in
+    // order, with each frame's damage being the tiles it changed, optionally paced by the
+    // recorded timestamps.
+    class SessionReader : public FrameSource {
+    public:
+        explicit SessionReader(const std::string& path, bool realtime = false)
+            : in_(path, std::ios::binary), realtime_(realtime) {
+            if (!in_) {
+                throw std::runtime_error("Cannot open recording file: " + path);
+            }
+            char magic[sizeof(kRecordingMagic)];
+            in_.read(magic, sizeof(magic));
+            int32_t tileSize = 0;
+            if (!in_ || std::memcmp(magic, kRecordingMagic, sizeof(magic)) != 0 || !readValue(in_, tileSize) || tileSize <= 0) {
+                throw std::runtime_error("Not a recording file: " + path);
+            }
+            tileSize_ = tileSize;
+
+            uint32_t frameMagic;
+            uint64_t length;
+            while (readValue(in_, frameMagic) && frameMagic == kFrameMagic && readValue(in_, length)) {
+                Entry entry;
+                entry.offset = in_.tellg();
+                entry.length = length;
+                TileFrame header;
+                std::vector<uchar> head(std::min<uint64_t>(length, kTileFrameHeaderBytes));
+                in_.read(reinterpret_cast<char*>(head.data()), static_cast<std::streamsize>(head.size()));
+                if (!in_ || !decodeTileFrameHeader(head.data(), head.size(), header)) {
+                    break;
+                }
+                entry.key = header.key;
+                entry.timestampUs = header.timestampUs;
+                index_.push_back(entry);
+                in_.seekg(entry.offset + static_cast<std::streamoff>(length));
+            }
+            in_.clear();
+        }
+
+        size_t size() const { return index_.size(); }
+
+        Result<cv::Mat> frame(size_t n) {
+            if (n >= index_.size()) {
+                return Result<cv::Mat>::failure(ErrorCode::OutOfBounds);
+            }
+            size_t start = n;
+            while (!index_[start].key && start > 0) {
+                --start;
+            }
+            if (!index_[start].key) {
+                return Result<cv::Mat>::failure(ErrorCode::EmptyImage);
+            }
+            if (decoded_ != SIZE_MAX && decoded_ <= n && decoded_ >= start) {
+                start = decoded_ + 1;
+            }
+            for (size_t i = start; i <= n; ++i) {
+                if (!apply(i)) {
+                    decoded_ = SIZE_MAX;
+                    return Result<cv::Mat>::failure(ErrorCode::EmptyImage);
+                }
+            }
+            return current_.clone();
+        }
+
+        bool next(std::chrono::steady_clock::time_point deadline) override {
+            const size_t n = position_;
+            if (n >= index_.size()) {
+                std::this_thread::sleep_until(deadline);
+                return false;
+            }
+            if (realtime_) {
+                if (n == 0) {
+                    replayStart_ = std::chrono::steady_clock::now();
+                }
+                auto due = replayStart_ + std::chrono::microseconds(index_[n].timestampUs - index_[0].timestampUs);
+                if (due > deadline) {
+                    std::this_thread::sleep_until(deadline);
+                    return false;
+                }
+                std::this_thread::sleep_until(due);
+            }
+            if (decoded_ + 1 != n && !frame(n).ok()) {
+                return false;
+            }
+            if (decoded_ + 1 == n && !apply(n)) {
+                return false;
+            }
+            ++position_;
+            publish(current_.clone(), lastDamage_, index_[n].key);
+            return true;
+        }
+
+        void rewind() { position_ = 0; }
+
+    private:
+        struct Entry {
+            std::streamoff offset;
+            uint64_t length;
+            bool key;
+            int64_t timestampUs;
+        };
+
+        bool apply(size_t n) {
+            const Entry& entry = index_[n];
+            std::vector<uchar> payload(entry.length);
+            in_.seekg(entry.offset);
+            in_.read(reinterpret_cast<char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+            if (!in_ || !decodeTileFrame(payload.data(), payload.size(), tileSize_, current_, &lastDamage_)) {
+                in_.clear();
+                return false;
+            }
+            decoded_ = n;
+            return true;
+        }
+
+        std::ifstream in_;
+        bool realtime_;
+        int tileSize_ = 0;
+        std::vector<Entry> index_;
+        cv::Mat current_;
+        std::vector<cv::Rect> lastDamage_;
+        size_t decoded_ = SIZE_MAX;
+        size_t position_ = 0;
+        std::chrono::steady_clock::time_point replayStart_;
+    };
+
+    // Rolling in-memory history of recent frames, stored in the SessionRecorder format:
+    // keyframes plus tile deltas coded with the same lossless tile codec. When the stored bytes
+    // exceed the budget the oldest keyframe group is evicted as a whole, so every retained frame
+    // can always be rebuilt.
+    class RewindBuffer {
+    public:
+        struct Stats {
+            size_t frames;
+            size_t keyframes;
+            size_t storedBytes;
+            size_t rawBytes;
+            double compressionRatio;
+        };
+
+        explicit RewindBuffer(size_t memoryBudget = size_t(64) << 20, int tileSize = 64, int keyframeInterval = 30)
+            : budget_(memoryBudget), tileSize_(tileSize), keyframeInterval_(std::max(keyframeInterval, 1)) {
+            if (tileSize <= 0) {
+                throw std::invalid_argument("Tile size must be positive.");
+            }
+        }
+
+        // Returns the index assigned to the frame.
+        uint64_t push(const cv::Mat& frame) {
+            if (frame.empty()) {
+                throw std::invalid_argument("The frame is empty.");
+            }
+            std::lock_guard<std::mutex> lock(mutex_);
+            TileFrame tileFrame;
+            tileFrame.index = next_;
+            tileFrame.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+            tileFrame.key = forceKey_ || previous_.empty() || previous_.size() != frame.size() ||
+                previous_.type() != frame.type() || sinceKeyframe_ >= keyframeInterval_;
+            tileFrame.size = frame.size();
+            tileFrame.type = frame.type();
+            tileFrame.tiles = collectTiles(tileFrame.key ? cv::Mat() : previous_, frame, tileSize_);
+
+            Record record{ next_, tileFrame.key, encodeTileFrame(tileFrame), frame.total() * frame.elemSize() };
+            storedBytes_ += record.payload.size();
+            rawBytes_ += record.rawBytes;
+            keyframes_ += record.key ? 1 : 0;
+            records_.push_back(std::move(record));
+            sinceKeyframe_ = tileFrame.key ? 1 : sinceKeyframe_ + 1;
+            forceKey_ = false;
+            applyTiles(previous_, frame.size(), frame.type(), tileFrame.tiles, tileSize_);
+            evict();
+            return next_++;
+        }
+
+        size_t size() const { std::lock_guard<std::mutex> lock(mutex_); return records_.size(); }
+
+        // Indices of the oldest and newest retained frames; failure while the buffer is empty.
+        Result<std::pair<uint64_t, uint64_t>> range() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (records_.empty()) {
+                return Result<std::pair<uint64_t, uint64_t>>::failure(ErrorCode::EmptyImage);
+            }
+            return std::make_pair(records_.front().index, records_.back().index);
+        }
+
+        Result<cv::Mat> materialize(uint64_t index) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (records_.empty() || index < records_.front().index || index > records_.back().index) {
+                return Result<cv::Mat>::failure(ErrorCode::OutOfBounds);
+            }
+            size_t target = static_cast<size_t>(index - records_.front().index);
+            size_t start = target;
+            while (!records_[start].key) {
+                --start;
+            }
+            if (cachedIndex_ != UINT64_MAX && cachedIndex_ <= index && cachedIndex_ >= records_[start].index) {
+                start = static_cast<size_t>(cachedIndex_ - records_.front().index) + 1;
+            }
+            for (size_t i = start; i <= target; ++i) {
+                const std::vector<uchar>& payload = records_[i].payload;
+                if (!decodeTileFrame(payload.data(), payload.size(), tileSize_, cached_, nullptr)) {
+                    cachedIndex_ = UINT64_MAX;
+                    return Result<cv::Mat>::failure(ErrorCode::EmptyImage);
+                }
+                cachedIndex_ = records_[i].index;
+            }
+            return cached_.clone();
+        }
+
+        // Frame framesAgo pushes before the newest one.
+        Result<cv::Mat> materializeAgo(size_t framesAgo) const {
+            Result<std::pair<uint64_t, uint64_t>> retained = range();
+            if (!retained.ok() || framesAgo > retained->second - retained->first) {
+                return Result<cv::Mat>::failure(ErrorCode::OutOfBounds);
+            }
+            return materialize(retained->second - framesAgo);
+        }
+
+        Stats stats() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return Stats{ records_.size(), keyframes_, storedBytes_, rawBytes_,
+                storedBytes_ > 0 ? static_cast<double>(rawBytes_) / storedBytes_ : 0.0 };
+        }
+
+    private:
+        struct Record {
+            uint64_t index;
+            bool key;
+            std::vector<uchar> payload;
+            size_t rawBytes;
+        };
+
+        // Drops whole groups from the front while over budget. A single group larger than the
+        // budget cannot be split, so the next push starts a new group.
+        void evict() {
+            while (storedBytes_ > budget_) {
+                size_t end = 1;
+                while (end < records_.size() && !records_[end].key) {
+                    ++end;
+                }
+                if (end >= records_.size()) {
+                    forceKey_ = true;
+                    return;
+                }
+                for (size_t i = 0; i < end; ++i) {
+                    storedBytes_ -= records_.front().payload.size();
+                    rawBytes_ -= records_.front().rawBytes;
+                    keyframes_ -= records_.front().key ? 1 : 0;
+                    records_.pop_front();
+                }
+                if (cachedIndex_ != UINT64_MAX && cachedIndex_ < records_.front().index) {
+                    cachedIndex_ = UINT64_MAX;
+                }
+            }
+        }
+
+        size_t budget_;
+        int tileSize_;
+        int keyframeInterval_;
+
+        mutable std::mutex mutex_;
+        std::deque<Record> records_;
+        cv::Mat previous_;
+        uint64_t next_ = 0;
+        int sinceKeyframe_ = 0;
+        bool forceKey_ = false;
+        size_t storedBytes_ = 0;
+        size_t rawBytes_ = 0;
+        size_t keyframes_ = 0;
+
+        mutable cv::Mat cached_;
+        mutable uint64_t cachedIndex_ = UINT64_MAX;
+    };
+
+    // Blocks until the template appears inside roi with at least minScore (TM_CCOEFF_NORMED).
+    // The search runs once on the current screen and then only on frames whose damage touches
+    // roi. The returned rect is in frame coordinates.
+    static Result<cv::Rect> waitForImage(FrameSource& source, const cv::Mat& smallImage, const cv::Rect& roi = cv::Rect(),
+        double minScore = 0.9, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+        if (smallImage.empty()) {
+            return Result<cv::Rect>::failure(ErrorCode::EmptyImage);
+        }
+        cv::Mat templ = grayView(smallImage);
+        double best = 0.0;
+        Result<cv::Rect> found = waitUntil<cv::Rect>(source, roi, timeout, [&](const Frame& frame) {
+            cv::Rect area = searchArea(frame, roi);
+            if (area.width < templ.cols || area.height < templ.rows) {
+                return Result<cv::Rect>::failure(ErrorCode::OutOfBounds);
+            }
+            cv::Mat result;
+            cv::matchTemplate(grayView(frame.image(area)), templ, result, cv::TM_CCOEFF_NORMED);
+            double maxVal;
+            cv::Point maxLoc;
+            cv::minMaxLoc(result, nullptr, &maxVal, nullptr, &maxLoc);
+            best = std::max(best, maxVal);
+            if (maxVal < minScore) {
+                return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, maxVal);
+            }
+            return Result<cv::Rect>(cv::Rect(area.tl() + maxLoc, templ.size()), maxVal);
+        });
+        return found.ok() ? found : Result<cv::Rect>::failure(found.error(), best);
+    }
+
+    static Result<cv::Point> waitForPixelColor(FrameSource& source, const cv::Vec3b& targetColor, const cv::Rect& roi = cv::Rect(),
+        int tolerance = 0, std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+        return waitUntil<cv::Point>(source, roi, timeout, [&](const Frame& frame) {
+            cv::Rect area = searchArea(frame, roi);
+            if (area.empty()) {
+                return Result<cv::Point>::failure(ErrorCode::OutOfBounds);
+            }
+            Result<cv::Point> hit = locatePixelColor(frame.image(area), targetColor, tolerance);
+            return hit.ok() ? Result<cv::Point>(area.tl() + *hit) : hit;
+        });
+    }
+
+    // Blocks until anything inside roi changes and returns the bounding box of the change.
+    static Result<cv::Rect> waitForChange(FrameSource& source, const cv::Rect& roi = cv::Rect(),
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        source.next(std::chrono::steady_clock::now());
+        while (source.next(deadline)) {
+            const Frame& frame = source.frame();
+            cv::Rect area = searchArea(frame, roi);
+            cv::Rect changed;
+            if (frame.fullDamage) {
+                changed = area;
+            }
+            for (const cv::Rect& rect : frame.damage) {
+                cv::Rect part = rect & area;
+                if (!part.empty()) {
+                    changed = changed.empty() ? part : (changed | part);
+                }
+            }
+            if (!changed.empty()) {
+                return changed;
+            }
+        }
+        return Result<cv::Rect>::failure(ErrorCode::Timeout);
+    }
+
+    // Evaluates check on the current screen, then again each time damage touches roi, until it
+    // succeeds or the timeout passes.
+    template<typename T>
+    static Result<T> waitUntil(FrameSource& source, const cv::Rect& roi, std::chrono::milliseconds timeout,
+        const std::function<Result<T>(const Frame&)>& check) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        source.next(std::chrono::steady_clock::now());
+        if (!source.frame().image.empty()) {
+            Result<T> result = check(source.frame());
+            if (result.ok()) {
+                return result;
+            }
+        }
+        while (source.next(deadline)) {
+            if (!source.frame().intersects(roi)) {
+                continue;
+            }
+            Result<T> result = check(source.frame());
+            if (result.ok()) {
+                return result;
+            }
+        }
+        return Result<T>::failure(ErrorCode::Timeout);
+    }
+
+    // 64-bit perceptual hash: the sign of the low-frequency 8x8 DCT block of a 32x32 grayscale
+    // thumbnail, relative to its median. Near-identical screens differ in only a few bits.
+    static uint64_t perceptualHash(const cv::Mat& image) {
+        if (image.empty()) {
+            throw std::invalid_argument("The image is empty.");
+        }
+        cv::Mat small, spectrum;
+        cv::resize(grayView(image), small, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+        small.convertTo(small, CV_32F);
+        cv::dct(small, spectrum);
+
+        std::array<float, 64> low;
+        for (int y = 0; y < 8; ++y) {
+            for (int x = 0; x < 8; ++x) {
+                low[y * 8 + x] = spectrum.at<float>(y, x);
+            }
+        }
+        std::array<float, 63> ac;
+        std::copy(low.begin() + 1, low.end(), ac.begin());
+        std::nth_element(ac.begin(), ac.begin() + ac.size() / 2, ac.end());
+        const float median = ac[ac.size() / 2];
+
+        uint64_t hash = 0;
+        for (int i = 0; i < 64; ++i) {
+            if (low[i] > median) {
+                hash |= uint64_t(1) << i;
+            }
+        }
+        return hash;
+    }
+
+    // Nearest-neighbour lookup of known screen states by perceptual hash. A signature is one hash
+    // per region (the whole frame when no regions are given); regions are fractions of the frame
+    // so the index works across resolutions. Signatures live in a BK-tree keyed on total Hamming
+    // distance, so a lookup only visits the branches that can still beat the best match.
+    class SceneIndex {
+    public:
+        explicit SceneIndex(std::vector<cv::Rect2d> regions = {}) : regions_(std::move(regions)) {
+            for (const cv::Rect2d& region : regions_) {
+                if (region.width <= 0 || region.height <= 0 || region.x < 0 || region.y < 0 ||
+                    region.x + region.width > 1.0 || region.y + region.height > 1.0) {
+                    throw std::invalid_argument("Scene regions must be non-empty fractions of the frame.");
+                }
+            }
+        }
+
+        std::vector<uint64_t> signature(const cv::Mat& frame) const {
+            if (regions_.empty()) {
+                return { perceptualHash(frame) };
+            }
+            std::vector<uint64_t> hashes;
+            hashes.reserve(regions_.size());
+            for (const cv::Rect2d& region : regions_) {
+                cv::Rect area(cvRound(region.x * frame.cols), cvRound(region.y * frame.rows),
+                    std::max(1, cvRound(region.width * frame.cols)), std::max(1, cvRound(region.height * frame.rows)));
+                hashes.push_back(perceptualHash(frame(area & cv::Rect(0, 0, frame.cols, frame.rows))));
+            }
+            return hashes;
+        }
+
+        void add(const std::string& label, const cv::Mat& frame) {
+            insert(label, signature(frame));
+        }
+
+        void insert(const std::string& label, std::vector<uint64_t> hashes) {
+            if (hashes.size() != std::max<size_t>(regions_.size(), 1)) {
+                throw std::invalid_argument("Signature does not match the index regions.");
+            }
+            Node node{ std::move(hashes), label, {} };
+            if (nodes_.empty()) {
+                nodes_.push_back(std::move(node));
+                return;
+            }
+            int current = 0;
+            for (;;) {
+                int d = distance(nodes_[current].hashes, node.hashes);
+                auto child = nodes_[current].children.find(d);
+                if (child == nodes_[current].children.end()) {
+                    nodes_[current].children.emplace(d, static_cast<int>(nodes_.size()));
+                    nodes_.push_back(std::move(node));
+                    return;
+                }
+                current = child->second;
+            }
+        }
+
+        // Label of the closest known state within maxDistance bits; the score is the distance.
+        Result<std::string> classify(const cv::Mat& frame, int maxDistance = 10) const {
+            if (frame.empty()) {
+                return Result<std::string>::failure(ErrorCode::EmptyImage);
+            }
+            return nearest(signature(frame), maxDistance);
+        }
+
+        Result<std::string> nearest(const std::vector<uint64_t>& hashes, int maxDistance = 10) const {
+            if (hashes.size() != std::max<size_t>(regions_.size(), 1)) {
+                throw std::invalid_argument("Signature does not match the index regions.");
+            }
+            if (nodes_.empty()) {
+                return Result<std::string>::failure(ErrorCode::NoMatches);
+            }
+            int best = -1;
+            int bestDistance = INT_MAX;
+            std::vector<int> stack = { 0 };
+            while (!stack.empty()) {
+                const Node& node = nodes_[stack.back()];
+                const int index = stack.back();
+                stack.pop_back();
+                int d = distance(node.hashes, hashes);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = index;
+                }
+                const int radius = std::min(maxDistance, bestDistance);
+                for (auto it = node.children.lower_bound(d - radius); it != node.children.end() && it->first <= d + radius; ++it) {
+                    stack.push_back(it->second);
+                }
+            }
+            if (bestDistance > maxDistance) {
+                return Result<std::string>::failure(ErrorCode::BelowThreshold, bestDistance);
+            }
+            return Result<std::string>(nodes_[best].label, bestDistance);
+        }
+
+        size_t size() const { return nodes_.size(); }
+
+    private:
+        struct Node {
+            std::vector<uint64_t> hashes;
+            std::string label;
+            std::map<int, int> children;
+        };
+
+        static int distance(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b) {
+            return static_cast<int>(hammingDistance(reinterpret_cast<const uchar*>(a.data()),
+                reinterpret_cast<const uchar*>(b.data()), static_cast<int>(a.size() * sizeof(uint64_t))));
+        }
+
+        std::vector<cv::Rect2d> regions_;
+        std::vector<Node> nodes_;
+    };
+
+    // Conditions tied to screen regions. Watchers are bucketed in a uniform grid so that update()
+    // only evaluates those whose ROI touches the frame's damage; callbacks fire on the caller's
+    // thread when a watcher's state flips. Predicates may run concurrently and must not share
+    // mutable state.
+    class WatcherRegistry {
+    public:
+        typedef int Id;
+        typedef std::function<bool(const cv::Mat& region)> Predicate;
+        typedef std::function<void(Id id, bool state)> Callback;
+
+        explicit WatcherRegistry(int cellSize = 128) : cellSize_(std::max(cellSize, 1)) {}
+
+        Id add(const cv::Rect& roi, Predicate predicate, Callback callback) {
+            if (roi.empty()) {
+                throw std::invalid_argument("Watcher ROI is empty.");
+            }
+            Id id = static_cast<Id>(watchers_.size());
+            watchers_.push_back({ roi, std::move(predicate), std::move(callback), false, true, true, 0 });
+            forEachCell(roi, [&](int64_t key) { grid_[key].push_back(id); });
+            pending_.push_back(id);
+            ++live_;
+            return id;
+        }
+
+        // True while the template matches somewhere inside roi with TM_CCOEFF_NORMED >= minScore.
+        Id addTemplate(const cv::Rect& roi, const cv::Mat& smallImage, double minScore, Callback callback) {
+            if (smallImage.empty()) {
+                throw std::invalid_argument("Watcher template is empty.");
+            }
+            cv::Mat templ = grayView(smallImage).clone();
+            return add(roi, [templ, minScore](const cv::Mat& region) {
+                if (region.cols < templ.cols || region.rows < templ.rows) {
+                    return false;
+                }
+                cv::Mat result;
+                cv::matchTemplate(grayView(region), templ, result, cv::TM_CCOEFF_NORMED);
+                double maxVal;
+                cv::minMaxLoc(result, nullptr, &maxVal);
+                return maxVal >= minScore;
+            }, std::move(callback));
+        }
+
+        // True while any pixel inside roi is within tolerance of the colour.
+        Id addColour(const cv::Rect& roi, const cv::Vec3b& targetColor, int tolerance, Callback callback) {
+            return add(roi, [targetColor, tolerance](const cv::Mat& region) {
+                return locatePixelColor(region, targetColor, tolerance).ok();
+            }, std::move(callback));
+        }
+
+        void remove(Id id) {
+            Watcher& watcher = at(id);
+            if (!watcher.alive) {
+                return;
+            }
+            forEachCell(watcher.roi, [&](int64_t key) {
+                std::vector<Id>& cell = grid_[key];
+                cell.erase(std::remove(cell.begin(), cell.end(), id), cell.end());
+                if (cell.empty()) {
+                    grid_.erase(key);
+                }
+            });
+            watcher.alive = false;
+            watcher.predicate = nullptr;
+            watcher.callback = nullptr;
+            --live_;
+        }
+
+        bool state(Id id) const { return at(id).state; }
+        size_t size() const { return live_; }
+
+        // Re-evaluates watchers touched by the frame's damage plus any added since the last call.
+        // Returns the number of predicates run.
+        int update(const Frame& frame) {
+            if (frame.image.empty()) {
+                return 0;
+            }
+            ++stamp_;
+            std::vector<Id> due;
+            auto visit = [&](Id id, const cv::Rect* damage) {
+                Watcher& watcher = watchers_[id];
+                if (!watcher.alive || watcher.stamp == stamp_) {
+                    return;
+                }
+                if (watcher.pending || !damage || !(watcher.roi & *damage).empty()) {
+                    watcher.stamp = stamp_;
+                    due.push_back(id);
+                }
+            };
+
+            if (frame.fullDamage || frame.image.size() != frameSize_) {
+                frameSize_ = frame.image.size();
+                for (Id id = 0; id < static_cast<Id>(watchers_.size()); ++id) {
+                    visit(id, nullptr);
+                }
+            }
+            else {
+                for (const cv::Rect& damage : frame.damage) {
+                    forEachCell(damage, [&](int64_t key) {
+                        auto cell = grid_.find(key);
+                        if (cell != grid_.end()) {
+                            for (Id id : cell->second) {
+                                visit(id, &damage);
+                            }
+                        }
+                    });
+                }
+                for (Id id : pending_) {
+                    visit(id, nullptr);
+                }
+            }
+            pending_.clear();
+
+            const cv::Rect bounds(0, 0, frame.image.cols, frame.image.rows);
+            std::vector<uchar> results(due.size(), 0);
+            cv::parallel_for_(cv::Range(0, static_cast<int>(due.size())), [&](const cv::Range& range) {
+                for (int i = range.start; i < range.end; ++i) {
+                    const Watcher& watcher = watchers_[due[i]];
+                    cv::Rect area = watcher.roi & bounds;
+                    results[i] = !area.empty() && watcher.predicate(frame.image(area));
+                }
+            });
+
+            // Callbacks may add or remove watchers, which can reallocate watchers_ or clear the
+            // running callback, so each one is invoked through a local copy.
+            for (size_t i = 0; i < due.size(); ++i) {
+                Watcher& watcher = watchers_[due[i]];
+                if (!watcher.alive) {
+                    continue;
+                }
+                bool state = results[i] != 0;
+                bool changed = state != watcher.state;
+                watcher.state = state;
+                watcher.pending = false;
+                if (changed && watcher.callback) {
+                    Callback callback = watcher.callback;
+                    callback(due[i], state);
+                }
+            }
+            return static_cast<int>(due.size());
+        }
+
+    private:
+        struct Watcher {
+            cv::Rect roi;
+            Predicate predicate;
+            Callback callback;
+            bool state;
+            bool pending;
+            bool alive;
+            uint64_t stamp;
+        };
+
+        const Watcher& at(Id id) const {
+            if (id < 0 || id >= static_cast<Id>(watchers_.size())) {
+                throw std::out_of_range("Unknown watcher id.");
+            }
+            return watchers_[id];
+        }
+
+        Watcher& at(Id id) {
+            return const_cast<Watcher&>(static_cast<const WatcherRegistry*>(this)->at(id));
+        }
+
+        template<typename Fn>
+        void forEachCell(const cv::Rect& rect, Fn fn) const {
+            const int x0 = floorDiv(rect.x), x1 = floorDiv(rect.x + rect.width - 1);
+            const int y0 = floorDiv(rect.y), y1 = floorDiv(rect.y + rect.height - 1);
+            for (int cy = y0; cy <= y1; ++cy) {
+                for (int cx = x0; cx <= x1; ++cx) {
+                    fn((static_cast<int64_t>(cy) << 32) | static_cast<uint32_t>(cx));
+                }
+            }
+        }
+
+        int floorDiv(int v) const {
+            return v >= 0 ? v / cellSize_ : -((-v + cellSize_ - 1) / cellSize_);
+        }
+
+        int cellSize_;
+        std::unordered_map<int64_t, std::vector<Id>> grid_;
+        std::vector<Watcher> watchers_;
+        std::vector<Id> pending_;
+        cv::Size frameSize_;
+        uint64_t stamp_ = 0;
+        size_t live_ = 0;
+    };
+
+    #ifdef _WIN32
+    static HBITMAP CaptureScreen(int x = 0, int y = 0, int width = GetSystemMetrics(SM_CXSCREEN), int height = GetSystemMetrics(SM_CYSCREEN)) {
+        HDC hScreenDC = GetDC(NULL);
+        HDC hMemoryDC = CreateCompatibleDC(hScreenDC);
+
+        HBITMAP hBitmap = CreateCompatibleBitmap(hScreenDC, width, height);
+        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+
+        BitBlt(hMemoryDC, 0, 0, width, height, hScreenDC, x, y, SRCCOPY);
+
+        SelectObject(hMemoryDC, hOldBitmap);
+
+        DeleteDC(hMemoryDC);
+        ReleaseDC(NULL, hScreenDC);
+
+        return hBitmap;
+    }
+
+    static HBITMAP CaptureWindow(HWND hwnd) {
+        HDC hWindowDC = GetWindowDC(hwnd);
+        RECT rc;
+        GetWindowRect(hwnd, &rc);
+        int width = rc.right - rc.left;
+        int height = rc.bottom - rc.top;
+
+        HDC hMemoryDC = CreateCompatibleDC(hWindowDC);
+        HBITMAP hBitmap = CreateCompatibleBitmap(hWindowDC, width, height);
+        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+
+        if (!PrintWindow(hwnd, hMemoryDC, PW_RENDERFULLCONTENT)) {
+            BitBlt(hMemoryDC, 0, 0, width, height, hWindowDC, 0, 0, SRCCOPY);
+        }
+
+        SelectObject(hMemoryDC, hOldBitmap);
+        DeleteDC(hMemoryDC);
+        ReleaseDC(hwnd, hWindowDC);
+
+        return hBitmap;
+    }
+
+    static HWND FindWindowByTitle(const std::wstring& title) {
+        return FindWindow(NULL, title.c_str());
+    }
+
+    static cv::Mat HBitmapToMat(HBITMAP hBitmap) {
+        BITMAP bmp;
+        GetObject(hBitmap, sizeof(BITMAP), &bmp);
+        int width = bmp.bmWidth;
+        int height = bmp.bmHeight;
+
+        HDC hMemoryDC = CreateCompatibleDC(NULL);
+        HBITMAP hOldBitmap = (HBITMAP)SelectObject(hMemoryDC, hBitmap);
+
+        cv::Mat mat(height, width, CV_8UC4); 
+
+        BITMAPINFO bi = { 0 };
+        bi.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        bi.bmiHeader.biWidth = width;
+        bi.bmiHeader.biHeight = -height; 
+        bi.bmiHeader.biPlanes = 1;
+        bi.bmiHeader.biBitCount = 32;
+        bi.bmiHeader.biCompression = BI_RGB;
+
+        GetDIBits(hMemoryDC, hBitmap, 0, height, mat.data, &bi, DIB_RGB_COLORS);
+
+        SelectObject(hMemoryDC, hOldBitmap);
+        DeleteDC(hMemoryDC);
+
+        return mat;
+    }
+
+    static void ClickAtPosition(int x, int y) {
+        INPUT inputs[2] = {};
+        
+        inputs[0].type = INPUT_MOUSE;
+        inputs[0].mi.dwFlags = MOUSEEVENTF_LEFTDOWN;
+        inputs[0].mi.dx = (LONG)x;
+        inputs[0].mi.dy = (LONG)y;
+        inputs[0].mi.dwExtraInfo = 0;
+
+        inputs[1].type = INPUT_MOUSE;
+        inputs[1].mi.dwFlags = MOUSEEVENTF_LEFTUP;
+        inputs[1].mi.dx = (LONG)x;
+        inputs[1].mi.dy = (LONG)y;
+        inputs[1].mi.dwExtraInfo = 0;
+
+        
+        SetCursorPos(x, y);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        SendInput(2, inputs, sizeof(INPUT));
+    }
+
+    cv::Mat ResourceToMat(int resourceID, const std::string& resourceType) {
+        HRSRC hResource = FindResource(NULL, MAKEINTRESOURCE(resourceID), resourceType.c_str());
+        if (hResource == NULL) {
+            return cv::Mat();
+        }
+
+        HGLOBAL hLoadedResource = LoadResource(NULL, hResource);
+        if (hLoadedResource == NULL) {
+            return cv::Mat();
+        }
+
+        DWORD dwResourceSize = SizeofResource(NULL, hResource);
+        const void* pResourceData = LockResource(hLoadedResource);
+
+        std::vector<uchar> buffer((uchar*)pResourceData, (uchar*)pResourceData + dwResourceSize);
+        cv::Mat image = cv::imdecode(buffer, cv::IMREAD_COLOR);
+        return image;
+    }
+
+    #elif __APPLE__
+    /*CGImageRef CaptureScreen(int x = 0, int y = 0, int width = CGDisplayPixelsWide(kCGDirectMainDisplay), int height = CGDisplayPixelsHigh(kCGDirectMainDisplay)) {
+        CGRect captureRect = CGRectMake(x, y, width, height);
+        return CGWindowListCreateImage(captureRect, kCGWindowListOptionOnScreenOnly, kCGNullWindowID, kCGWindowImageDefault);
+    }
+
+    CGImageRef CaptureWindow(CGWindowID windowID) {
+        CGImageRef image = CGWindowListCreateImage(
+            CGRectNull,
+            kCGWindowListOptionOnScreenOnly,
+            windowID,
+            kCGWindowImageDefault
+        );
+        
+        if (!image) {
+            throw std::runtime_error("Failed to capture window.");
+        }
+        return image;
+    }
+
+    static CGWindowID FindWindowByTitle(const std::string& title) {
+        uint32_t windowListSize;
+        CFArrayRef windowList = CGWindowListCopyWindowInfo(kCGWindowListOptionAll, kCGNullWindowID);
+        CFIndex count = CFArrayGetCount(windowList);
+        for (CFIndex i = 0; i < count; ++i) {
+            CFDictionaryRef windowInfo = (CFDictionaryRef)CFArrayGetValueAtIndex(windowList, i);
+            CFStringRef windowTitleRef = (CFStringRef)CFDictionaryGetValue(windowInfo, kCGWindowName);
+            if (windowTitleRef) {
+                char windowTitle[256];
+                if (CFStringGetCString(windowTitleRef, windowTitle, sizeof(windowTitle), kCFStringEncodingUTF8)) {
+                    if (title == windowTitle) {
+                        CFRelease(windowList);
+                        return (CGWindowID)CFDictionaryGetValue(windowInfo, CFSTR("kCGWindowID"));
+                    }
+                }
+            }
+        }
+        CFRelease(windowList);
+        return 0;
+    }*/
+
+    static cv::Mat CGImageToMat(CGImageRef image) {
+        size_t width = CGImageGetWidth(image);
+        size_t height = CGImageGetHeight(image);
+        
+        cv::Mat mat(height, width, CV_8UC4);
+        
+        CGContextRef context = CGBitmapContextCreate(mat.data, width, height, 8, mat.step[0], 
+                                                    CGColorSpaceCreateDeviceRGB(), 
+                                                    kCGImageAlphaPremultipliedLast | kCGBitmapByteOrder32Big);
+        if (!context) {
+            throw std::runtime_error("Failed to create CGContext.");
+        }
+        
+        CGContextDrawImage(context, CGRectMake(0, 0, width, height), image);
+        CGContextRelease(context);
+        
+        return mat;
+    }
+
+    static void ClickAtPosition(int x, int y) {
+        CGPoint point = CGPointMake(x, y);
+        CGEventRef downEvent = CGEventCreateMouseEvent(NULL, kCGEventLeftMouseDown, point, CGMouseButton::kCGMouseButtonLeft);
+        CGEventRef upEvent = CGEventCreateMouseEvent(NULL, kCGEventLeftMouseUp, point, CGMouseButton::kCGMouseButtonLeft);
+
+        CGEventPost(kCGHIDEventTap, downEvent);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CGEventPost(kCGHIDEventTap, upEvent);
+
+        CFRelease(downEvent);
+        CFRelease(upEvent);
+    }
+
+    #elif __linux__
+    XImage* CaptureScreen(Display* display, int x = 0, int y = 0, int width = 0, int height = 0) {
+        Window root = DefaultRootWindow(display);
+        XWindowAttributes attributes;
+        XGetWindowAttributes(display, root, &attributes);
+
+        if (width == 0) width = attributes.width;
+        if (height == 0) height = attributes.height;
+
+        return XGetImage(display, root, x, y, width, height, AllPlanes, ZPixmap);
+    }
+
+    Pixmap CaptureWindow(Display* display, Window window) {
+        XWindowAttributes attrs;
+        XGetWindowAttributes(display, window, &attrs);
+
+        Pixmap pixmap = XCreatePixmap(display, window, attrs.width, attrs.height, attrs.depth);
+        if (!pixmap) {
+            throw std::runtime_error("Failed to create pixmap.");
+        }
+
+        GC gc = XCreateGC(display, pixmap, 0, NULL);
+        XCopyArea(display, window, pixmap, gc, 0, 0, attrs.width, attrs.height, 0, 0);
+        XFreeGC(display, gc);
+
+        return pixmap;
+    }
+
+    static Window FindWindowByTitle(Display* display, const std::string& title) {
+        Window root = DefaultRootWindow(display);
+        Window returnedRoot, returnedParent;
+        Window* children;
+        unsigned int numChildren;
+        Atom type;
+        int format;
+        unsigned long items, bytes;
+
+        if (XQueryTree(display, root, &returnedRoot, &returnedParent, &children, &numChildren)) {
+            for (unsigned int i = 0; i < numChildren; ++i) {
+                char* windowTitle;
+                Atom name = XInternAtom(display, "WM_NAME", True);
+                if (XGetWindowProperty(display, children[i], name, 0, 1024, False, AnyPropertyType, 
+                                    &type, &format, &items, &bytes, (unsigned char**)&windowTitle) == Success) {
+                    if (windowTitle && title == windowTitle) {
+                        XFree(windowTitle);
+                        return children[i];
+                    }
+                    XFree(windowTitle);
+                }
+            }
+        }
+        return 0;
+    }
+
+    static cv::Mat XImageToMat(XImage* xImage) {
+        int width = xImage->width;
+        int height = xImage->height;
+
+        cv::Mat mat(height, width, CV_8UC4);
+
+        memcpy(mat.data, xImage->data, height * xImage->bytes_per_line);
+
+        return mat;
+    }
+
+    static void ClickAtPosition(int x, int y) {
+        Display* display = XOpenDisplay(NULL);
+        if (!display) {
+            logFailure(ErrorCode::DisplayUnavailable, "ClickAtPosition");
+            return;
+        }
+
+        SendButtonEvent(display, x, y, true);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        SendButtonEvent(display, x, y, false);
+
+        XCloseDisplay(display);
+    }
+
+    static void SendButtonEvent(Display* display, int x, int y, bool press) {
+        if (press) {
+            XWarpPointer(display, None, DefaultRootWindow(display), 0, 0, 0, 0, x, y);
+            XFlush(display);
+        }
+
+        XEvent event;
+        event.xbutton.type = press ? ButtonPress : ButtonRelease;
+        event.xbutton.button = Button1;
+        event.xbutton.root = DefaultRootWindow(display);
+        event.xbutton.subwindow = DefaultRootWindow(display);
+        event.xbutton.x = x;
+        event.xbutton.y = y;
+        event.xbutton.x_root = x;
+        event.xbutton.y_root = y;
+        event.xbutton.same_screen = True;
+
+        XSendEvent(display, PointerWindow, True, press ? ButtonPressMask : ButtonReleaseMask, &event);
+        XFlush(display);
+    }
+
+    #ifdef IP_HAVE_XRANDR
+    // One active monitor: an XRandR output driven by a CRTC, in root-window coordinates.
+    struct MonitorOutput {
+        std::string name;
+        cv::Rect bounds;
+        bool primary;
+    };
+
+    // Captures individual monitors instead of the whole root window. The output list is read
+    // from XRandR and re-read when refresh() sees a screen, CRTC or output change event, so
+    // hotplugged or rearranged monitors are picked up. Link with -lXrandr.
+    class OutputCapture {
+    public:
+        struct OutputFrame {
+            MonitorOutput output;
+            cv::Mat image;
+        };
+
+        OutputCapture() {
+            display_ = XOpenDisplay(NULL);
+            if (!display_) {
+                throw std::runtime_error("Cannot open X display.");
+            }
+            int errorBase;
+            if (!XRRQueryExtension(display_, &eventBase_, &errorBase)) {
+                XCloseDisplay(display_);
+                throw std::runtime_error("XRandR extension is not available.");
+            }
+            root_ = DefaultRootWindow(display_);
+            XRRSelectInput(display_, root_, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+            enumerate();
+        }
+
+        ~OutputCapture() {
+            XCloseDisplay(display_);
+        }
+
+        OutputCapture(const OutputCapture&) = delete;
+        OutputCapture& operator=(const OutputCapture&) = delete;
+
+        int fd() const { return ConnectionNumber(display_); }
+        const std::vector<MonitorOutput>& outputs() const { return outputs_; }
+
+        // Handles pending XRandR events; returns true when the monitor layout was re-read.
+        bool refresh() {
+            bool changed = false;
+            while (XPending(display_)) {
+                XEvent event;
+                XNextEvent(display_, &event);
+                if (event.type == eventBase_ + RRScreenChangeNotify || event.type == eventBase_ + RRNotify) {
+                    XRRUpdateConfiguration(&event);
+                    changed = true;
+                }
+            }
+            if (changed) {
+                enumerate();
+            }
+            return changed;
+        }
+
+        Result<OutputFrame> capture(const std::string& name) {
+            refresh();
+            for (const MonitorOutput& output : outputs_) {
+                if (output.name == name) {
+                    return grab(output);
+                }
+            }
+            return Result<OutputFrame>::failure(ErrorCode::DisplayUnavailable);
+        }
+
+        Result<OutputFrame> capturePrimary() {
+            refresh();
+            for (const MonitorOutput& output : outputs_) {
+                if (output.primary) {
+                    return grab(output);
+                }
+            }
+            if (outputs_.empty()) {
+                return Result<OutputFrame>::failure(ErrorCode::DisplayUnavailable);
+            }
+            return grab(outputs_.front());
+        }
+
+        // Outputs that are not connected are skipped.
+        std::vector<OutputFrame> capture(const std::vector<std::string>& names) {
+            refresh();
+            std::vector<OutputFrame> frames;
+            for (const MonitorOutput& output : outputs_) {
+                if (std::find(names.begin(), names.end(), output.name) != names.end()) {
+                    Result<OutputFrame> frame = grab(output);
+                    if (frame.ok()) {
+                        frames.push_back(std::move(*frame));
+                    }
+                }
+            }
+            return frames;
+        }
+
+    private:
+        void enumerate() {
+            outputs_.clear();
+            XRRScreenResources* resources = XRRGetScreenResourcesCurrent(display_, root_);
+            if (!resources) {
+                return;
+            }
+            RROutput primary = XRRGetOutputPrimary(display_, root_);
+            for (int i = 0; i < resources->noutput; ++i) {
+                XRROutputInfo* info = XRRGetOutputInfo(display_, resources, resources->outputs[i]);
+                if (!info) {
+                    continue;
+                }
+                if (info->connection == RR_Connected && info->crtc) {
+                    XRRCrtcInfo* crtc = XRRGetCrtcInfo(display_, resources, info->crtc);
+                    if (crtc && crtc->width > 0 && crtc->height > 0) {
+                        outputs_.push_back({ std::string(info->name, info->nameLen),
+                            cv::Rect(crtc->x, crtc->y, static_cast<int>(crtc->width), static_cast<int>(crtc->height)),
+                            resources->outputs[i] == primary });
+                    }
+                    if (crtc) {
+                        XRRFreeCrtcInfo(crtc);
+                    }
+                }
+                XRRFreeOutputInfo(info);
+            }
+            XRRFreeScreenResources(resources);
+        }
+
+        Result<OutputFrame> grab(const MonitorOutput& output) {
+            const cv::Rect& r = output.bounds;
+            XImage* xImage = XGetImage(display_, root_, r.x, r.y, r.width, r.height, AllPlanes, ZPixmap);
+            if (!xImage) {
+                return Result<OutputFrame>::failure(ErrorCode::DisplayUnavailable);
+            }
+            OutputFrame frame{ output, cv::Mat() };
+            cv::Mat(r.height, r.width, CV_8UC4, xImage->data, xImage->bytes_per_line).copyTo(frame.image);
+            XDestroyImage(xImage);
+            return frame;
+        }
+
+        Display* display_ = nullptr;
+        Window root_ = 0;
+        int eventBase_ = 0;
+        std::vector<MonitorOutput> outputs_;
+    };
+    #endif
+
+    #ifdef IP_HAVE_XDAMAGE
+    // Root-window frames driven by XDamage. After the first full capture only the damaged
+    // rectangles are read back from the server. A non-empty area (for example a
+    // MonitorOutput's bounds) restricts frames to that part of the root window; frame
+    // coordinates are then relative to its top-left corner. Link with -lXdamage -lXfixes.
+    class DamageFrameSource : public FrameSource {
+    public:
+        explicit DamageFrameSource(const cv::Rect& area = cv::Rect()) : area_(area) {
+            display_ = XOpenDisplay(NULL);
+            if (!display_) {
+                throw std::runtime_error("Cannot open X display.");
+            }
+            int errorBase;
+            if (!XDamageQueryExtension(display_, &eventBase_, &errorBase)) {
+                XCloseDisplay(display_);
+                throw std::runtime_error("XDamage extension is not available.");
+            }
+            root_ = DefaultRootWindow(display_);
+            damage_ = XDamageCreate(display_, root_, XDamageReportNonEmpty);
+            region_ = XFixesCreateRegion(display_, NULL, 0);
+        }
+
+        ~DamageFrameSource() override {
+            XFixesDestroyRegion(display_, region_);
+            XDamageDestroy(display_, damage_);
+            XCloseDisplay(display_);
+        }
+
+        DamageFrameSource(const DamageFrameSource&) = delete;
+        DamageFrameSource& operator=(const DamageFrameSource&) = delete;
+
+        int fd() const override { return ConnectionNumber(display_); }
+        bool pending() const override { return XEventsQueued(display_, QueuedAlready) > 0; }
+
+        bool next(std::chrono::steady_clock::time_point deadline) override {
+            if (frame_.image.empty()) {
+                XWindowAttributes attributes;
+                XGetWindowAttributes(display_, root_, &attributes);
+                cv::Rect screen(0, 0, attributes.width, attributes.height);
+                area_ = area_.empty() ? screen : (area_ & screen);
+                cv::Mat image(area_.height, area_.width, CV_8UC4);
+                readArea(image, cv::Rect(0, 0, image.cols, image.rows));
+                XDamageSubtract(display_, damage_, None, None);
+                publish(image, {}, true);
+                return true;
+            }
+            for (;;) {
+                // Damage that falls entirely outside area_ publishes nothing; keep waiting.
+                if (drainEvents() && collectDamage()) {
+                    return true;
+                }
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                if (remaining.count() <= 0) {
+                    return false;
+                }
+                pollfd descriptor = { ConnectionNumber(display_), POLLIN, 0 };
+                poll(&descriptor, 1, static_cast<int>(std::min<int64_t>(remaining.count(), INT32_MAX)));
+            }
+        }
+
+    private:
+        bool drainEvents() {
+            bool damaged = false;
+            while (XPending(display_)) {
+                XEvent event;
+                XNextEvent(display_, &event);
+                if (event.type == eventBase_ + XDamageNotify) {
+                    damaged = true;
+                }
+            }
+            return damaged;
+        }
+
+        bool collectDamage() {
+            XDamageSubtract(display_, damage_, None, region_);
+            int count = 0;
+            XRectangle* rects = XFixesFetchRegion(display_, region_, &count);
+            cv::Mat image = frame_.image.clone();
+            const cv::Rect bounds(0, 0, image.cols, image.rows);
+            std::vector<cv::Rect> damage;
+            for (int i = 0; i < count; ++i) {
+                cv::Rect rect = (cv::Rect(rects[i].x, rects[i].y, rects[i].width, rects[i].height) - area_.tl()) & bounds;
+                if (!rect.empty()) {
+                    readArea(image, rect);
+                    damage.push_back(rect);
+                }
+            }
+            if (rects) {
+                XFree(rects);
+            }
+            if (damage.empty()) {
+                return false;
+            }
+            publish(image, std::move(damage), false);
+            return true;
+        }
+
+        void readArea(cv::Mat& image, const cv::Rect& rect) {
+            XImage* xImage = XGetImage(display_, root_, area_.x + rect.x, area_.y + rect.y, rect.width, rect.height, AllPlanes, ZPixmap);
+            if (!xImage) {
+                return;
+            }
+            cv::Mat(rect.height, rect.width, CV_8UC4, xImage->data, xImage->bytes_per_line).copyTo(image(rect));
+            XDestroyImage(xImage);
+        }
+
+        Display* display_ = nullptr;
+        Window root_ = 0;
+        Damage damage_ = 0;
+        XserverRegion region_ = 0;
+        int eventBase_ = 0;
+        cv::Rect area_;
+    };
+    #endif
+
+    // How MatchServer compares a template with the frame: normalised cross-correlation,
+    // ORB features with precomputed template descriptors, or exact-size icon SAD.
+    enum class MatchMethod : uint8_t { Template = 0, ORB = 1, Icon = 2 };
+
+    // Long-running matcher behind a Unix domain socket. Templates are decoded once and their
+    // gray images, ORB descriptors and per-channel-count copies are kept for the server's
+    // lifetime, so a request only pays for the search. Frames arrive as a sealed memfd passed
+    // with SCM_RIGHTS, which stays mapped for the connection until the client sends a new one,
+    // or, when allowPaths is set, as an image path the server opens with its own privileges.
+    // One thread serves all connections through epoll on non-blocking sockets; partial requests
+    // are buffered per connection and only complete ones are answered.
+    //
+    // The socket is created with mode 0600 and only peers running as the server's effective
+    // user are accepted. Messages are a little-endian header (magic, version, op, payload
+    // length) and a payload packed field by field; see MatchClient for the request layout.
+    class MatchServer {
+    public:
+        explicit MatchServer(const std::string& socketPath, bool allowPaths = false)
+            : path_(socketPath), allowPaths_(allowPaths) {
+            listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (listener_ < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("Cannot create socket: " + socketPath);
+            }
+            std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            unlink(socketPath.c_str());
+            // The umask is process-wide; it only narrows permissions for the duration of bind.
+            const mode_t previous = umask(0177);
+            const bool bound = bind(listener_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            umask(previous);
+            if (!bound || listen(listener_, 64) != 0) {
+                close(listener_);
+                throw std::runtime_error("Cannot listen on socket: " + socketPath);
+            }
+            epoll_ = epoll_create1(EPOLL_CLOEXEC);
+            stop_ = eventfd(0, EFD_CLOEXEC);
+            watch(listener_, EPOLLIN);
+            watch(stop_, EPOLLIN);
+        }
+
+        ~MatchServer() {
+            for (auto& connection : connections_) {
+                release(connection.second);
+                close(connection.first);
+            }
+            close(listener_);
+            close(stop_);
+            close(epoll_);
+            unlink(path_.c_str());
+        }
+
+        MatchServer(const MatchServer&) = delete;
+        MatchServer& operator=(const MatchServer&) = delete;
+
+        // Returns the id clients use for this template.
+        uint32_t addTemplate(const std::string& name, const cv::Mat& image) {
+            if (image.empty() || image.depth() != CV_8U) {
+                throw std::invalid_argument("Template must be a non-empty 8-bit image: " + name);
+            }
+            Template entry;
+            entry.name = name;
+            entry.gray = grayView(image).clone();
+            computeKeypointsAndDescriptors(entry.gray, entry.keypoints, entry.descriptors);
+            entry.byChannels[1] = entry.gray;
+            cv::Mat bgr = image.channels() == 3 ? image : cv::Mat();
+            if (bgr.empty()) {
+                cv::cvtColor(image, bgr, image.channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR);
+            }
+            entry.byChannels[3] = bgr.clone();
+            cv::cvtColor(bgr, entry.byChannels[4], cv::COLOR_BGR2BGRA);
+            templates_.push_back(std::move(entry));
+            return static_cast<uint32_t>(templates_.size() - 1);
+        }
+
+        // Loads every decodable image in directory, named by file stem, in sorted path order.
+        void loadDirectory(const std::string& directory) {
+            std::vector<std::filesystem::path> paths;
+            for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+                paths.push_back(entry.path());
+            }
+            std::sort(paths.begin(), paths.end());
+            for (const auto& path : paths) {
+                cv::Mat image = cv::imread(path.string(), cv::IMREAD_UNCHANGED);
+                if (!image.empty() && image.depth() == CV_8U) {
+                    addTemplate(path.stem().string(), image);
+                }
+            }
+        }
+
+        size_t templateCount() const { return templates_.size(); }
+
+        // Serves until stop() is called from any thread.
+        void serve() {
+            epoll_event events[32];
+            for (;;) {
+                int count = epoll_wait(epoll_, events, 32, -1);
+                for (int i = 0; i < count; ++i) {
+                    const int fd = events[i].data.fd;
+                    if (fd == stop_) {
+                        uint64_t value;
+                        (void)!read(stop_, &value, sizeof(value));
+                        return;
+                    }
+                    if (fd == listener_) {
+                        accept();
+                        continue;
+                    }
+                    auto connection = connections_.find(fd);
+                    if (connection != connections_.end() && !service(fd, connection->second, events[i].events)) {
+                        epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+                        release(connection->second);
+                        close(fd);
+                        connections_.erase(connection);
+                    }
+                }
+            }
+        }
+
+        void stop() {
+            uint64_t one = 1;
+            (void)!write(stop_, &one, sizeof(one));
+        }
+
+    private:
+        struct Template {
+            std::string name;
+            cv::Mat gray;
+            std::vector<cv::KeyPoint> keypoints;
+            cv::Mat descriptors;
+            std::array<cv::Mat, 5> byChannels;
+        };
+
+        struct Connection {
+            int frameFd = -1;
+            void* mapping = nullptr;
+            size_t mappedBytes = 0;
+            std::deque<int> passed;
+            std::vector<uchar> input;
+            std::vector<uchar> output;
+            size_t written = 0;
+            bool writing = false;
+        };
+
+        static constexpr size_t kMaxPassedFds = 4;
+
+        void watch(int fd, uint32_t events) {
+            epoll_event event = {};
+            event.events = events;
+            event.data.fd = fd;
+            epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+        }
+
+        static void release(Connection& connection) {
+            if (connection.mapping) {
+                munmap(connection.mapping, connection.mappedBytes);
+            }
+            if (connection.frameFd >= 0) {
+                close(connection.frameFd);
+            }
+            for (int fd : connection.passed) {
+                close(fd);
+            }
+            connection = Connection();
+        }
+
+        void accept() {
+            for (;;) {
+                int client = accept4(listener_, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+                if (client < 0) {
+                    return;
+                }
+                ucred peer;
+                socklen_t length = sizeof(peer);
+                if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 || peer.uid != geteuid()) {
+                    close(client);
+                    continue;
+                }
+                connections_[client] = Connection();
+                watch(client, EPOLLIN);
+            }
+        }
+
+        // Reads what the socket holds, answers every complete request and sends what it can of
+        // the replies; false closes the connection.
+        bool service(int fd, Connection& connection, uint32_t events) {
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (!receive(fd, connection) || !dispatch(connection)) {
+                    return false;
+                }
+            }
+            return flush(fd, connection);
+        }
+
+        bool receive(int fd, Connection& connection) {
+            uchar buffer[64 * 1024];
+            for (;;) {
+                iovec part = { buffer, sizeof(buffer) };
+                msghdr header = {};
+                header.msg_iov = &part;
+                header.msg_iovlen = 1;
+                alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+                header.msg_control = control;
+                header.msg_controllen = sizeof(control);
+                ssize_t got = recvmsg(fd, &header, MSG_CMSG_CLOEXEC);
+                if (got < 0) {
+                    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+                }
+                for (cmsghdr* c = CMSG_FIRSTHDR(&header); c; c = CMSG_NXTHDR(&header, c)) {
+                    if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                        const size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                        for (size_t i = 0; i < count; ++i) {
+                            int passed;
+                            std::memcpy(&passed, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                            connection.passed.push_back(passed);
+                        }
+                    }
+                }
+                if (got == 0 || (header.msg_flags & MSG_CTRUNC) || connection.passed.size() > kMaxPassedFds) {
+                    return false;
+                }
+                connection.input.insert(connection.input.end(), buffer, buffer + got);
+                if (connection.input.size() > kMatchHeaderBytes + kMaxMatchPayload) {
+                    return false;
+                }
+            }
+        }
+
+        bool dispatch(Connection& connection) {
+            size_t consumed = 0;
+            bool ok = true;
+            for (;;) {
+                const uchar* in = connection.input.data() + consumed;
+                const uchar* end = connection.input.data() + connection.input.size();
+                if (static_cast<size_t>(end - in) < kMatchHeaderBytes) {
+                    break;
+                }
+                uint32_t op, length;
+                if (!takeMatchHeader(in, end, kMatchRequestMagic, op, length)) {
+                    ok = false;
+                    break;
+                }
+                if (static_cast<size_t>(end - in) < length) {
+                    break;
+                }
+                std::vector<uchar> response;
+                if (!answer(connection, op, in, in + length, response)) {
+                    ok = false;
+                    break;
+                }
+                appendMatchMessage(connection.output, kMatchResponseMagic, op, response);
+                consumed = static_cast<size_t>(in - connection.input.data()) + length;
+            }
+            connection.input.erase(connection.input.begin(), connection.input.begin() + consumed);
+            return ok;
+        }
+
+        bool flush(int fd, Connection& connection) {
+            while (connection.written < connection.output.size()) {
+                ssize_t sent = send(fd, connection.output.data() + connection.written,
+                    connection.output.size() - connection.written, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        break;
+                    }
+                    return false;
+                }
+                connection.written += static_cast<size_t>(sent);
+            }
+            if (connection.written == connection.output.size()) {
+                connection.output.clear();
+                connection.written = 0;
+            }
+            const bool writing = !connection.output.empty();
+            if (writing != connection.writing) {
+                epoll_event event = {};
+                event.events = writing ? EPOLLIN | EPOLLOUT : EPOLLIN;
+                event.data.fd = fd;
+                epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event);
+                connection.writing = writing;
+            }
+            return true;
+        }
+
+        // Replaces the connection's frame buffer with the next passed descriptor. Only memfds
+        // sealed against shrinking are accepted, so the client cannot truncate a mapping the
+        // server is reading.
+        static bool adoptFrameFd(Connection& connection) {
+            if (connection.passed.empty()) {
+                return false;
+            }
+            const int passed = connection.passed.front();
+            connection.passed.pop_front();
+            if (connection.mapping) {
+                munmap(connection.mapping, connection.mappedBytes);
+            }
+            if (connection.frameFd >= 0) {
+                close(connection.frameFd);
+            }
+            connection.frameFd = -1;
+            connection.mapping = nullptr;
+            connection.mappedBytes = 0;
+
+            struct stat info;
+            const int seals = fcntl(passed, F_GET_SEALS);
+            if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(passed, &info) != 0 || info.st_size <= 0) {
+                close(passed);
+                return false;
+            }
+            void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, passed, 0);
+            if (mapping == MAP_FAILED) {
+                close(passed);
+                return false;
+            }
+            connection.frameFd = passed;
+            connection.mapping = mapping;
+            connection.mappedBytes = static_cast<size_t>(info.st_size);
+            return true;
+        }
+
+        // Builds the reply to one request; false means the request broke the protocol.
+        bool answer(Connection& connection, uint32_t op, const uchar* in, const uchar* end, std::vector<uchar>& response) {
+            if (op == kOpListTemplates) {
+                appendValue(response, static_cast<uint32_t>(templates_.size()));
+                for (const Template& entry : templates_) {
+                    appendValue(response, static_cast<uint16_t>(entry.name.size()));
+                    response.insert(response.end(), entry.name.begin(), entry.name.end());
+                }
+                return true;
+            }
+            if (op != kOpMatch) {
+                return false;
+            }
+
+            int32_t rows, cols, type, roiX, roiY, roiW, roiH, minMatchScore;
+            uint64_t step;
+            uint8_t source, method;
+            uint16_t pathLength;
+            double minScore;
+            uint32_t count;
+            if (!takeValue(in, end, source) || !takeValue(in, end, pathLength) || static_cast<size_t>(end - in) < pathLength) {
+                return false;
+            }
+            std::string path(reinterpret_cast<const char*>(in), pathLength);
+            in += pathLength;
+            if (!takeValue(in, end, rows) || !takeValue(in, end, cols) || !takeValue(in, end, type) || !takeValue(in, end, step) ||
+                !takeValue(in, end, roiX) || !takeValue(in, end, roiY) || !takeValue(in, end, roiW) || !takeValue(in, end, roiH) ||
+                !takeValue(in, end, method) || !takeValue(in, end, minScore) || !takeValue(in, end, minMatchScore) ||
+                !takeValue(in, end, count) || count > kMaxMatchIds || static_cast<size_t>(end - in) < count * sizeof(uint32_t)) {
+                return false;
+            }
+            if (source > kFrameFromPath || method > static_cast<uint8_t>(MatchMethod::Icon)) {
+                return false;
+            }
+            if (source == kFrameAttached && !adoptFrameFd(connection)) {
+                return false;
+            }
+
+            cv::Mat frame;
+            ErrorCode frameError = ErrorCode::Ok;
+            if (source == kFrameFromPath) {
+                if (!allowPaths_) {
+                    frameError = ErrorCode::NotPermitted;
+                }
+                else {
+                    frame = cv::imread(path, cv::IMREAD_UNCHANGED);
+                }
+            }
+            else if (connection.mapping && rows > 0 && cols > 0 && isMatchFrameType(type)) {
+                const uint64_t rowBytes = static_cast<uint64_t>(cols) * CV_ELEM_SIZE(type);
+                if (step >= rowBytes && static_cast<uint64_t>(rows) <= connection.mappedBytes / step) {
+                    frame = cv::Mat(rows, cols, type, connection.mapping, static_cast<size_t>(step));
+                }
+            }
+            if (frameError == ErrorCode::Ok && frame.empty()) {
+                frameError = ErrorCode::EmptyImage;
+            }
+            if (frameError == ErrorCode::Ok && !isMatchFrameType(frame.type())) {
+                frameError = ErrorCode::UnsupportedType;
+            }
+
+            cv::Rect area = cv::Rect(roiX, roiY, roiW, roiH);
+            const cv::Rect bounds(0, 0, frame.cols, frame.rows);
+            area = area.empty() ? bounds : (area & bounds);
+            if (frameError == ErrorCode::Ok && area.empty()) {
+                frameError = ErrorCode::InvalidROI;
+            }
+
+            cv::Mat region, regionGray, regionDescriptors;
+            std::vector<cv::KeyPoint> regionKeypoints;
+            if (frameError == ErrorCode::Ok) {
+                try {
+                    region = frame(area);
+                    regionGray = grayView(region);
+                    if (static_cast<MatchMethod>(method) == MatchMethod::ORB) {
+                        computeKeypointsAndDescriptors(regionGray, regionKeypoints, regionDescriptors);
+                    }
+                }
+                catch (const std::exception&) {
+                    frameError = ErrorCode::MatchFailed;
+                }
+            }
+
+            appendValue(response, count);
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t id;
+                takeValue(in, end, id);
+                Result<cv::Rect> result = Result<cv::Rect>::failure(frameError);
+                if (frameError == ErrorCode::Ok) {
+                    try {
+                        result = matchOne(region, regionGray, regionKeypoints, regionDescriptors, id,
+                            static_cast<MatchMethod>(method), minScore, minMatchScore);
+                    }
+                    catch (const std::exception&) {
+                        result = Result<cv::Rect>::failure(ErrorCode::MatchFailed);
+                    }
+                }
+                cv::Rect rect = result.ok() ? *result + area.tl() : cv::Rect();
+                appendValue(response, id);
+                appendValue(response, static_cast<uint8_t>(result.error()));
+                appendValue(response, result.score());
+                appendValue(response, static_cast<int32_t>(rect.x));
+                appendValue(response, static_cast<int32_t>(rect.y));
+                appendValue(response, static_cast<int32_t>(rect.width));
+                appendValue(response, static_cast<int32_t>(rect.height));
+            }
+            return true;
+        }
+
+        Result<cv::Rect> matchOne(const cv::Mat& region, const cv::Mat& regionGray, const std::vector<cv::KeyPoint>& regionKeypoints,
+            const cv::Mat& regionDescriptors, uint32_t id, MatchMethod method, double minScore, int minMatchScore) const {
+            if (id >= templates_.size()) {
+                return Result<cv::Rect>::failure(ErrorCode::UnknownTemplate);
+            }
+            const Template& entry = templates_[id];
+            if (regionGray.cols < entry.gray.cols || regionGray.rows < entry.gray.rows) {
+                return Result<cv::Rect>::failure(ErrorCode::OutOfBounds);
+            }
+            switch (method) {
+            case MatchMethod::ORB:
+                return tryFindImageInImageORB(regionGray, entry.gray, regionKeypoints, regionDescriptors,
+                    entry.keypoints, entry.descriptors, minMatchScore);
+            case MatchMethod::Icon:
+                return findIconInImage(region, entry.byChannels[region.channels()], minScore);
+            default: {
+                cv::Mat result;
+                cv::matchTemplate(regionGray, entry.gray, result, cv::TM_CCOEFF_NORMED);
+                double maxVal;
+                cv::Point maxLoc;
+                cv::minMaxLoc(result, nullptr, &maxVal, nullptr, &maxLoc);
+                if (maxVal < minScore) {
+                    return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, maxVal);
+                }
+                return Result<cv::Rect>(cv::Rect(maxLoc, entry.gray.size()), maxVal);
+            }
+            }
+        }
+
+        std::string path_;
+        bool allowPaths_;
+        int listener_ = -1;
+        int epoll_ = -1;
+        int stop_ = -1;
+        std::vector<Template> templates_;
+        std::unordered_map<int, Connection> connections_;
+    };
+
+    // Client side of MatchServer. Frames are handed over through a sealed memfd owned by the
+    // client: capture straight into sharedFrame() and match() sends no pixels at all; any other
+    // Mat is copied into the memfd first. The descriptor is passed to the server only when the
+    // memfd is created or grown. Frames must be CV_8UC1, CV_8UC3 or CV_8UC4.
+    //
+    // Match request payload: frame source (u8: 0 shared memfd, 1 memfd attached to this message,
+    // 2 path), path length (u16) and bytes, rows, cols, type (i32), step (u64), ROI x, y, width,
+    // height (i32), method (u8), min score (f64), ORB min match score (i32), template count (u32)
+    // and ids (u32 each). The response holds, per id: id (u32), error code (u8), score (f64) and
+    // rect x, y, width, height (i32).
+    class MatchClient {
+    public:
+        explicit MatchClient(const std::string& socketPath) {
+            socket_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            if (socket_ < 0 || socketPath.size() >= sizeof(address.sun_path)) {
+                throw std::runtime_error("Cannot create socket: " + socketPath);
+            }
+            std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            if (connect(socket_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                close(socket_);
+                throw std::runtime_error("Cannot connect to match server: " + socketPath);
+            }
+        }
+
+        ~MatchClient() {
+            if (mapping_) {
+                munmap(mapping_, mappedBytes_);
+            }
+            if (memfd_ >= 0) {
+                close(memfd_);
+            }
+            close(socket_);
+        }
+
+        MatchClient(const MatchClient&) = delete;
+        MatchClient& operator=(const MatchClient&) = delete;
+
+        // Template names indexed by id.
+        std::vector<std::string> templates() {
+            std::vector<uchar> response = request(kOpListTemplates, {}, -1);
+            const uchar* in = response.data();
+            const uchar* end = in + response.size();
+            uint32_t count = 0;
+            takeValue(in, end, count);
+            std::vector<std::string> names;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint16_t length;
+                if (!takeValue(in, end, length) || static_cast<size_t>(end - in) < length) {
+                    throw std::runtime_error("Malformed response from match server.");
+                }
+                names.emplace_back(reinterpret_cast<const char*>(in), length);
+                in += length;
+            }
+            return names;
+        }
+
+        // A Mat living in the shared memfd. It stays valid until the next call that needs a
+        // larger buffer.
+        cv::Mat sharedFrame(const cv::Size& size, int type) {
+            ensureShared(static_cast<size_t>(size.area()) * CV_ELEM_SIZE(type));
+            return cv::Mat(size, type, mapping_);
+        }
+
+        // minScore applies to Template (TM_CCOEFF_NORMED) and Icon searches; ORB uses
+        // minMatchScore on the 0-256 scale of tryFindImageInImageORB. A reply must fit the 1 MiB
+        // message limit, so more than about 36,000 ids throw std::invalid_argument.
+        std::vector<Result<cv::Rect>> match(const cv::Mat& frame, const std::vector<uint32_t>& ids, const cv::Rect& roi = cv::Rect(),
+            MatchMethod method = MatchMethod::Template, double minScore = 0.8, int minMatchScore = 230) {
+            if (frame.empty()) {
+                throw std::invalid_argument("The frame is empty.");
+            }
+            if (!isMatchFrameType(frame.type())) {
+                throw std::invalid_argument("Frames must be CV_8UC1, CV_8UC3 or CV_8UC4.");
+            }
+            const bool shared = mapping_ && frame.data == static_cast<const uchar*>(mapping_) &&
+                frame.step[0] * frame.rows <= mappedBytes_;
+            cv::Mat sent = frame;
+            if (!shared) {
+                sent = sharedFrame(frame.size(), frame.type());
+                frame.copyTo(sent);
+            }
+            return exchange(false, std::string(), sent.rows, sent.cols, sent.type(), sent.step[0], ids, roi, method, minScore, minMatchScore);
+        }
+
+        // Lets the server read the image itself; only served when the server allows paths.
+        std::vector<Result<cv::Rect>> match(const std::string& imagePath, const std::vector<uint32_t>& ids, const cv::Rect& roi = cv::Rect(),
+            MatchMethod method = MatchMethod::Template, double minScore = 0.8, int minMatchScore = 230) {
+            if (imagePath.size() > UINT16_MAX) {
+                throw std::invalid_argument("Image path is too long.");
+            }
+            return exchange(true, imagePath, 0, 0, 0, 0, ids, roi, method, minScore, minMatchScore);
+        }
+
+    private:
+        std::vector<Result<cv::Rect>> exchange(bool fromPath, const std::string& path, int rows, int cols, int type, size_t step,
+            const std::vector<uint32_t>& ids, const cv::Rect& roi, MatchMethod method, double minScore, int minMatchScore) {
+            if (ids.size() > kMaxMatchIds) {
+                throw std::invalid_argument("Too many template ids for one request.");
+            }
+            const int passFd = !fromPath && memfdChanged_ ? memfd_ : -1;
+            std::vector<uchar> payload;
+            payload.reserve(64 + path.size() + ids.size() * sizeof(uint32_t));
+            appendValue(payload, fromPath ? kFrameFromPath : passFd >= 0 ? kFrameAttached : kFrameShared);
+            appendValue(payload, static_cast<uint16_t>(path.size()));
+            payload.insert(payload.end(), path.begin(), path.end());
+            appendValue(payload, static_cast<int32_t>(rows));
+            appendValue(payload, static_cast<int32_t>(cols));
+            appendValue(payload, static_cast<int32_t>(type));
+            appendValue(payload, static_cast<uint64_t>(step));
+            appendValue(payload, static_cast<int32_t>(roi.x));
+            appendValue(payload, static_cast<int32_t>(roi.y));
+            appendValue(payload, static_cast<int32_t>(roi.width));
+            appendValue(payload, static_cast<int32_t>(roi.height));
+            appendValue(payload, static_cast<uint8_t>(method));
+            appendValue(payload, minScore);
+            appendValue(payload, static_cast<int32_t>(minMatchScore));
+            appendValue(payload, static_cast<uint32_t>(ids.size()));
+            for (uint32_t id : ids) {
+                appendValue(payload, id);
+            }
+
+            std::vector<uchar> response = request(kOpMatch, payload, passFd);
+            memfdChanged_ = memfdChanged_ && passFd < 0;
+
+            const uchar* in = response.data();
+            const uchar* end = in + response.size();
+            uint32_t count = 0;
+            takeValue(in, end, count);
+            std::vector<Result<cv::Rect>> results;
+            results.reserve(count);
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t id;
+                uint8_t error;
+                double score;
+                int32_t x, y, width, height;
+                if (!takeValue(in, end, id) || !takeValue(in, end, error) || !takeValue(in, end, score) ||
+                    !takeValue(in, end, x) || !takeValue(in, end, y) || !takeValue(in, end, width) || !takeValue(in, end, height)) {
+                    throw std::runtime_error("Malformed response from match server.");
+                }
+                results.push_back(error == static_cast<uint8_t>(ErrorCode::Ok)
+                    ? Result<cv::Rect>(cv::Rect(x, y, width, height), score)
+                    : Result<cv::Rect>::failure(static_cast<ErrorCode>(error), score));
+            }
+            return results;
+        }
+
+        std::vector<uchar> request(uint32_t op, const std::vector<uchar>& payload, int passFd) {
+            uint32_t responseOp;
+            std::vector<uchar> response;
+            if (!writeMatchMessage(socket_, kMatchRequestMagic, op, payload, passFd) ||
+                !readMatchMessage(socket_, kMatchResponseMagic, responseOp, response) || responseOp != op) {
+                throw std::runtime_error("Match server connection failed.");
+            }
+            return response;
+        }
+
+        void ensureShared(size_t bytes) {
+            if (mapping_ && bytes <= mappedBytes_) {
+                return;
+            }
+            if (mapping_) {
+                munmap(mapping_, mappedBytes_);
+                mapping_ = nullptr;
+            }
+            if (memfd_ >= 0) {
+                close(memfd_);
+            }
+            memfd_ = memfd_create("ip-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if (memfd_ < 0 || ftruncate(memfd_, static_cast<off_t>(bytes)) != 0 ||
+                fcntl(memfd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0) {
+                throw std::runtime_error("Cannot create shared frame buffer.");
+            }
+            mapping_ = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+            if (mapping_ == MAP_FAILED) {
+                mapping_ = nullptr;
+                throw std::runtime_error("Cannot map shared frame buffer.");
+            }
+            mappedBytes_ = bytes;
+            memfdChanged_ = true;
+        }
+
+        int socket_ = -1;
+        int memfd_ = -1;
+        void* mapping_ = nullptr;
+        size_t mappedBytes_ = 0;
+        bool memfdChanged_ = false;
+    };
+
+    #ifdef IP_HAVE_COROUTINES
+    // Single-threaded runtime for automation flows written as coroutines. The loop waits in
+    // epoll on the frame source's descriptor and on the nearest timer; each new frame is shared by
+    // every suspended waitForImage/waitForPixelColor/nextFrame, and template scores are computed
+    // once per frame, template and area no matter how many coroutines ask.
+    class EventLoop {
+    public:
+        class Task {
+        public:
+            struct promise_type {
+                std::coroutine_handle<> continuation;
+                std::exception_ptr error;
+
+                Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                struct FinalAwaiter {
+                    bool await_ready() noexcept { return false; }
+                    std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                        std::coroutine_handle<> next = handle.promise().continuation;
+                        return next ? next : std::noop_coroutine();
+                    }
+                    void await_resume() noexcept {}
+                };
+
+                FinalAwaiter final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { error = std::current_exception(); }
+            };
+
+            Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+            Task& operator=(Task&& other) noexcept {
+                if (this != &other) {
+                    if (handle_) {
+                        handle_.destroy();
+                    }
+                    handle_ = std::exchange(other.handle_, nullptr);
+                }
+                return *this;
+            }
+            Task(const Task&) = delete;
+            Task& operator=(const Task&) = delete;
+            ~Task() {
+                if (handle_) {
+                    handle_.destroy();
+                }
+            }
+
+            bool done() const { return !handle_ || handle_.done(); }
+
+            // Awaiting a task runs it to completion as a child of the awaiting coroutine.
+            bool await_ready() const { return done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+                handle_.promise().continuation = caller;
+                return handle_;
+            }
+            void await_resume() const { rethrow(); }
+
+        private:
+            friend class EventLoop;
+            explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+            void rethrow() const {
+                if (handle_ && handle_.promise().error) {
+                    std::rethrow_exception(handle_.promise().error);
+                }
+            }
+
+            std::coroutine_handle<promise_type> handle_;
+        };
+
+        explicit EventLoop(FrameSource* source = nullptr,
+            std::chrono::milliseconds pollInterval = std::chrono::milliseconds(16))
+            : pollInterval_(pollInterval) {
+            epoll_ = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_ < 0) {
+                throw std::runtime_error("epoll_create1 failed.");
+            }
+            setFrameSource(source);
+        }
+
+        ~EventLoop() {
+            tasks_.clear();
+            if (display_) {
+                XCloseDisplay(display_);
+            }
+            close(epoll_);
+        }
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        void setFrameSource(FrameSource* source) {
+            watchSource(false);
+            source_ = source;
+        }
+
+        void spawn(Task task) {
+            ready_.push_back(task.handle_);
+            tasks_.push_back(std::move(task));
+        }
+
+        // Runs until every spawned task has finished. The first exception escaping a task is
+        // rethrown here after the loop stops.
+        void run() {
+            while (!tasks_.empty()) {
+                drainReady();
+                for (auto it = tasks_.begin(); it != tasks_.end();) {
+                    if (it->done()) {
+                        it->rethrow();
+                        it = tasks_.erase(it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+                if (tasks_.empty()) {
+                    break;
+                }
+                if (ready_.empty()) {
+                    waitForEvents();
+                }
+            }
+        }
+
+        const Frame& frame() const {
+            static const Frame empty;
+            return source_ ? source_->frame() : empty;
+        }
+
+        // Timer entries still queued, cancelled ones included until they are compacted away.
+        size_t pendingTimers() const { return timers_.size(); }
+
+        auto sleepFor(std::chrono::steady_clock::duration duration) {
+            struct Awaiter {
+                EventLoop& loop;
+                std::chrono::steady_clock::time_point when;
+                bool await_ready() const { return when <= std::chrono::steady_clock::now(); }
+                void await_suspend(std::coroutine_handle<> handle) {
+                    loop.addTimer(when, [this, handle] { loop.ready_.push_back(handle); });
+                }
+                void await_resume() const {}
+            };
+            return Awaiter{ *this, std::chrono::steady_clock::now() + duration };
+        }
+
+        // Resumes with the next frame that has damage inside roi (anywhere when roi is empty).
+        auto nextFrame(const cv::Rect& roi = cv::Rect()) {
+            return FrameAwaiter<uint64_t>(*this, roi, std::chrono::steady_clock::time_point::max(), false,
+                [](const Frame& frame) { return Result<uint64_t>(frame.index); });
+        }
+
+        auto waitForImage(const cv::Mat& smallImage, const cv::Rect& roi = cv::Rect(), double minScore = 0.9,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+            if (smallImage.empty()) {
+                throw std::invalid_argument("The template is empty.");
+            }
+            cv::Mat templ = grayView(smallImage);
+            return FrameAwaiter<cv::Rect>(*this, roi, std::chrono::steady_clock::now() + timeout, true,
+                [this, smallImage, templ, roi, minScore](const Frame& frame) {
+                    cv::Rect area = searchArea(frame, roi);
+                    if (area.width < templ.cols || area.height < templ.rows) {
+                        return Result<cv::Rect>::failure(ErrorCode::OutOfBounds);
+                    }
+                    const Score& best = score(frame, smallImage, templ, area);
+                    if (best.value < minScore) {
+                        return Result<cv::Rect>::failure(ErrorCode::BelowThreshold, best.value);
+                    }
+                    return Result<cv::Rect>(cv::Rect(area.tl() + best.location, templ.size()), best.value);
+                });
+        }
+
+        auto waitForPixelColor(const cv::Vec3b& targetColor, const cv::Rect& roi = cv::Rect(), int tolerance = 0,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+            return FrameAwaiter<cv::Point>(*this, roi, std::chrono::steady_clock::now() + timeout, true,
+                [roi, targetColor, tolerance](const Frame& frame) {
+                    cv::Rect area = searchArea(frame, roi);
+                    if (area.empty()) {
+                        return Result<cv::Point>::failure(ErrorCode::OutOfBounds);
+                    }
+                    Result<cv::Point> hit = locatePixelColor(frame.image(area), targetColor, tolerance);
+                    return hit.ok() ? Result<cv::Point>(area.tl() + *hit) : hit;
+                });
+        }
+
+        // Presses, waits 50 ms on the loop rather than the thread, then releases.
+        auto click(int x, int y) {
+            struct Awaiter {
+                EventLoop& loop;
+                cv::Point position;
+                bool available = false;
+                bool await_ready() {
+                    available = loop.inputDisplay() != nullptr;
+                    return !available;
+                }
+                void await_suspend(std::coroutine_handle<> handle) {
+                    SendButtonEvent(loop.display_, position.x, position.y, true);
+                    loop.addTimer(std::chrono::steady_clock::now() + std::chrono::milliseconds(50), [this, handle] {
+                        SendButtonEvent(loop.display_, position.x, position.y, false);
+                        loop.ready_.push_back(handle);
+                    });
+                }
+                Result<cv::Point> await_resume() const {
+                    if (!available) {
+                        return Result<cv::Point>::failure(ErrorCode::DisplayUnavailable);
+                    }
+                    return position;
+                }
+            };
+            return Awaiter{ *this, cv::Point(x, y) };
+        }
+
+    private:
+        struct Waiter {
+            cv::Rect roi;
+            std::function<bool(const Frame&)> evaluate;
+            std::function<void()> expire;
+            std::coroutine_handle<> handle;
+            uint64_t deadline = 0;
+        };
+
+        // Heap entry; the callback lives in timerCallbacks_ under the same sequence, and an entry
+        // whose callback is gone was cancelled.
+        struct Timer {
+            std::chrono::steady_clock::time_point when;
+            uint64_t sequence;
+            bool operator>(const Timer& other) const {
+                return when != other.when ? when > other.when : sequence > other.sequence;
+            }
+        };
+
+        struct Score {
+            double value;
+            cv::Point location;
+            cv::Mat source;
+        };
+
+        // Suspends until check succeeds on a frame whose damage touches roi, or the deadline
+        // passes. With checkNow the current frame is tried first without suspending.
+        template<typename T>
+        class FrameAwaiter {
+        public:
+            FrameAwaiter(EventLoop& loop, const cv::Rect& roi, std::chrono::steady_clock::time_point deadline,
+                bool checkNow, std::function<Result<T>(const Frame&)> check)
+                : loop_(loop), roi_(roi), deadline_(deadline), checkNow_(checkNow), check_(std::move(check)) {}
+
+            bool await_ready() {
+                if (checkNow_ && !loop_.frame().image.empty()) {
+                    Result<T> now = check_(loop_.frame());
+                    if (now.ok()) {
+                        result_.emplace(std::move(now));
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void await_suspend(std::coroutine_handle<> handle) {
+                uint64_t id = loop_.addWaiter({ roi_,
+                    [this](const Frame& frame) {
+                        Result<T> next = check_(frame);
+                        if (!next.ok()) {
+                            return false;
+                        }
+                        result_.emplace(std::move(next));
+                        return true;
+                    },
+                    [this] { result_.emplace(Result<T>::failure(ErrorCode::Timeout)); },
+                    handle });
+                if (deadline_ != std::chrono::steady_clock::time_point::max()) {
+                    EventLoop& loop = loop_;
+                    loop_.waiters_[id].deadline = loop_.addTimer(deadline_, [&loop, id] { loop.expireWaiter(id); });
+                }
+            }
+
+            Result<T> await_resume() { return std::move(*result_); }
+
+        private:
+            EventLoop& loop_;
+            cv::Rect roi_;
+            std::chrono::steady_clock::time_point deadline_;
+            bool checkNow_;
+            std::function<Result<T>(const Frame&)> check_;
+            std::optional<Result<T>> result_;
+        };
+
+        uint64_t addWaiter(Waiter waiter) {
+            uint64_t id = ++nextId_;
+            waiters_.emplace(id, std::move(waiter));
+            return id;
+        }
+
+        void expireWaiter(uint64_t id) {
+            auto it = waiters_.find(id);
+            if (it != waiters_.end()) {
+                it->second.expire();
+                ready_.push_back(it->second.handle);
+                waiters_.erase(it);
+            }
+        }
+
+        uint64_t addTimer(std::chrono::steady_clock::time_point when, std::function<void()> fire) {
+            const uint64_t sequence = ++nextId_;
+            timerCallbacks_.emplace(sequence, std::move(fire));
+            timers_.push_back({ when, sequence });
+            std::push_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+            return sequence;
+        }
+
+        // Cancelled entries stay in the heap until they surface, unless they come to outnumber the
+        // live ones, in which case the heap is rebuilt without them.
+        void cancelTimer(uint64_t sequence) {
+            if (timerCallbacks_.erase(sequence) == 0 || timers_.size() <= 2 * timerCallbacks_.size()) {
+                return;
+            }
+            timers_.erase(std::remove_if(timers_.begin(), timers_.end(),
+                [this](const Timer& timer) { return timerCallbacks_.count(timer.sequence) == 0; }), timers_.end());
+            std::make_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+        }
+
+        // Pops cancelled entries off the top of the heap.
+        void skipCancelledTimers() {
+            while (!timers_.empty() && timerCallbacks_.count(timers_.front().sequence) == 0) {
+                std::pop_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+                timers_.pop_back();
+            }
+        }
+
+        // Keyed on the caller's template rather than its gray copy, which grayView allocates afresh
+        // for colour templates. The entry holds a reference to source so its address cannot be
+        // reused by another template while the entry lives.
+        const Score& score(const Frame& frame, const cv::Mat& source, const cv::Mat& templ, const cv::Rect& area) {
+            if (scoreFrame_ != frame.index) {
+                scores_.clear();
+                scoreFrame_ = frame.index;
+            }
+            std::ostringstream key;
+            key << static_cast<const void*>(source.data) << ':' << source.cols << 'x' << source.rows << ':'
+                << area.x << ',' << area.y << ',' << area.width << ',' << area.height;
+            auto it = scores_.find(key.str());
+            if (it == scores_.end()) {
+                cv::Mat result;
+                cv::matchTemplate(grayView(frame.image(area)), templ, result, cv::TM_CCOEFF_NORMED);
+                Score best;
+                best.source = source;
+                cv::minMaxLoc(result, nullptr, &best.value, nullptr, &best.location);
+                it = scores_.emplace(key.str(), best).first;
+            }
+            return it->second;
+        }
+
+        void watchSource(bool watch) {
+            if (!source_ || source_->fd() < 0 || watch == sourceWatched_) {
+                return;
+            }
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            epoll_ctl(epoll_, watch ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, source_->fd(), &event);
+            sourceWatched_ = watch;
+        }
+
+        Display* inputDisplay() {
+            if (!display_) {
+                display_ = XOpenDisplay(NULL);
+            }
+            return display_;
+        }
+
+        void drainReady() {
+            while (!ready_.empty()) {
+                std::coroutine_handle<> handle = ready_.front();
+                ready_.pop_front();
+                handle.resume();
+            }
+        }
+
+        void waitForEvents() {
+            const auto now = std::chrono::steady_clock::now();
+            int timeout = -1;
+            if (!timers_.empty()) {
+                auto until = std::chrono::duration_cast<std::chrono::milliseconds>(timers_.front().when - now).count();
+                timeout = static_cast<int>(std::clamp<int64_t>(until + 1, 0, INT32_MAX));
+            }
+            // The descriptor is level-triggered and only drained by next(), so it is watched only
+            // while some coroutine waits for a frame; otherwise epoll_wait would spin.
+            const bool watching = source_ && !waiters_.empty();
+            watchSource(watching);
+            if (watching && (source_->fd() < 0 || source_->frame().image.empty() || source_->pending())) {
+                bool immediate = source_->frame().image.empty() || source_->pending();
+                int poll = immediate ? 0 : static_cast<int>(pollInterval_.count());
+                timeout = timeout < 0 ? poll : std::min(timeout, poll);
+            }
+
+            epoll_event events[4];
+            epoll_wait(epoll_, events, 4, timeout);
+
+            if (watching && source_->next(std::chrono::steady_clock::now())) {
+                const Frame& current = source_->frame();
+                for (auto it = waiters_.begin(); it != waiters_.end();) {
+                    if (current.intersects(it->second.roi) && it->second.evaluate(current)) {
+                        ready_.push_back(it->second.handle);
+                        if (it->second.deadline) {
+                            cancelTimer(it->second.deadline);
+                        }
+                        it = waiters_.erase(it);
+                    }
+                    else {
+                        ++it;
+                    }
+                }
+            }
+
+            const auto fired = std::chrono::steady_clock::now();
+            // Leaves a live timer (or nothing) on top, so the next timeout is never computed from a
+            // cancelled deadline.
+            for (skipCancelledTimers(); !timers_.empty() && timers_.front().when <= fired; skipCancelledTimers()) {
+                auto callback = timerCallbacks_.find(timers_.front().sequence);
+                std::function<void()> fire = std::move(callback->second);
+                timerCallbacks_.erase(callback);
+                std::pop_heap(timers_.begin(), timers_.end(), std::greater<Timer>());
+                timers_.pop_back();
+                fire();
+            }
+        }
+
+        FrameSource* source_ = nullptr;
+        bool sourceWatched_ = false;
+        std::chrono::milliseconds pollInterval_;
+        int epoll_ = -1;
+        Display* display_ = nullptr;
+        std::vector<Task> tasks_;
+        std::deque<std::coroutine_handle<>> ready_;
+        std::unordered_map<uint64_t, Waiter> waiters_;
+        std::vector<Timer> timers_;
+        std::unordered_map<uint64_t, std::function<void()>> timerCallbacks_;
+        std::unordered_map<std::string, Score> scores_;
+        uint64_t scoreFrame_ = 0;
+        uint64_t nextId_ = 0;
+    };
+    #endif
+    #endif
+    
+    cv::Mat ByteArrayToMat(const std::vector<uchar>& byteArray) {
+        cv::Mat image = cv::imdecode(byteArray, cv::IMREAD_COLOR);
+        return image;
+    }
+
+    static void displayImage(const cv::Mat& image, const std::string& windowName) {
+        if (image.empty()) {
+            logFailure(ErrorCode::EmptyImage, "displayImage");
+            return;
+        }
+        cv::namedWindow(windowName, cv::WINDOW_AUTOSIZE);
+        cv::imshow(windowName, image);
+        cv::waitKey(0);
+    }
+
+    // Snapshot of one search for offline inspection. Images are stored as thumbnails; keypoints,
+    // matches and rects stay in the coordinates of the searched images.
+    struct DebugRecord {
+        std::string tag;
+        std::chrono::system_clock::time_point time;
+        cv::Mat largeThumbnail, smallThumbnail;
+        double largeScale = 1.0, smallScale = 1.0;
+        std::vector<cv::KeyPoint> keypointsLarge, keypointsSmall;
+        std::vector<cv::DMatch> matches;
+        std::vector<cv::Rect> rects;
+        double score = 0.0;
+
+        DebugRecord() = default;
+
+        DebugRecord(const std::string& tag, const cv::Mat& largeImage, const cv::Mat& smallImage)
+            : tag(tag), time(std::chrono::system_clock::now()) {
+            largeThumbnail = thumbnail(largeImage, largeScale);
+            smallThumbnail = thumbnail(smallImage, smallScale);
+        }
+    };
+
+    // Renders debug records to image files on a background thread, which sleeps while the queue is
+    // empty. Producers never block: when the queue is full the record is dropped and counted.
+    class DebugSink {
+    public:
+        static DebugSink& instance() {
+            static DebugSink sink;
+            return sink;
+        }
+
+        ~DebugSink() {
+            stop_.store(true);
+            parker_.notify();
+            if (worker_.joinable()) {
+                worker_.join();
+            }
+        }
+
+        void setDirectory(const std::string& directory) {
+            std::lock_guard<std::mutex> lock(directoryMutex_);
+            directory_ = directory;
+        }
+
+        bool accepting() const {
+            return queue_.sizeApprox() < queue_.capacity();
+        }
+
+        bool push(DebugRecord&& record) {
+            std::call_once(started_, [this] { worker_ = std::thread(&DebugSink::run, this); });
+            if (!queue_.tryPush(std::move(record))) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            parker_.notify();
+            return true;
+        }
+
+        uint64_t written() const { return written_.load(std::memory_order_relaxed); }
+        uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        DebugSink() : queue_(64) {
+            const char* directory = std::getenv("IP_DEBUG_DIR");
+            directory_ = directory ? directory : "ip_debug";
+        }
+
+        void run() {
+            DebugRecord record;
+            uint64_t sequence = 0;
+            for (;;) {
+                if (!queue_.tryPop(record)) {
+                    if (stop_.load()) {
+                        return;
+                    }
+                    parker_.park([this] { return stop_.load() || queue_.sizeApprox() > 0; });
+                    continue;
+                }
+
+                std::string directory;
+                {
+                    std::lock_guard<std::mutex> lock(directoryMutex_);
+                    directory = directory_;
+                }
+                std::error_code error;
+                std::filesystem::create_directories(directory, error);
+
+                auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(record.time.time_since_epoch()).count();
+                std::ostringstream name;
+                name << millis << "_" << sequence++ << "_" << record.tag << ".png";
+                if (cv::imwrite((std::filesystem::path(directory) / name.str()).string(), render(record))) {
+                    written_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        static cv::Mat render(const DebugRecord& record) {
+            cv::Mat large = toBGR(record.largeThumbnail);
+            cv::Mat small = toBGR(record.smallThumbnail);
+
+            std::vector<cv::KeyPoint> keypointsLarge = record.keypointsLarge;
+            std::vector<cv::KeyPoint> keypointsSmall = record.keypointsSmall;
+            for (cv::KeyPoint& kp : keypointsLarge) {
+                kp.pt = kp.pt * record.largeScale;
+            }
+            for (cv::KeyPoint& kp : keypointsSmall) {
+                kp.pt = kp.pt * record.smallScale;
+            }
+            for (const cv::Rect& rect : record.rects) {
+                cv::Rect scaled(cvRound(rect.x * record.largeScale), cvRound(rect.y * record.largeScale),
+                    cvRound(rect.width * record.largeScale), cvRound(rect.height * record.largeScale));
+                cv::rectangle(large, scaled, cv::Scalar(0, 0, 255), 2);
+            }
+
+            cv::Mat out;
+            if (!small.empty() && !record.matches.empty()) {
+                cv::drawMatches(small, keypointsSmall, large, keypointsLarge, record.matches, out);
+            }
+            else {
+                cv::drawKeypoints(large, keypointsLarge, out, cv::Scalar(0, 255, 0));
+            }
+
+            std::ostringstream label;
+            label << record.tag << " score=" << record.score;
+            cv::putText(out, label.str(), cv::Point(4, 16), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 255, 255), 1);
+            return out;
+        }
+
+        static cv::Mat toBGR(const cv::Mat& image) {
+            if (image.empty() || image.channels() == 3) {
+                return image;
+            }
+            cv::Mat bgr;
+            cv::cvtColor(image, bgr, image.channels() == 4 ? cv::COLOR_BGRA2BGR : cv::COLOR_GRAY2BGR);
+            return bgr;
+        }
+
+        BoundedQueue<DebugRecord> queue_;
+        std::once_flag started_;
+        std::thread worker_;
+        std::atomic<bool> stop_{ false };
+        Parker parker_;
+        std::atomic<uint64_t> written_{ 0 };
+        std::atomic<uint64_t> dropped_{ 0 };
+        std::mutex directoryMutex_;
+        std::string directory_;
+    };
+
+    static cv::Mat getRegionOfInterest(const cv::Mat& image, const cv::Rect& roi) {
+        return valueOrLog(tryGetRegionOfInterest(image, roi), cv::Mat(), "getRegionOfInterest");
+    }
+
+    static Result<cv::Mat> tryGetRegionOfInterest(const cv::Mat& image, const cv::Rect& roi) {
+        if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
+            roi.x + roi.width > image.cols || roi.y + roi.height > image.rows) {
+            return Result<cv::Mat>::failure(ErrorCode::InvalidROI);
+        }
+
+        cv::Mat roiImage = image(roi);
+        return roiImage;
+    }
+
+    static cv::Rect getRoiFromKeyphrase(const std::string& keyphrase, const cv::Size& imageSize) {
+        
+        auto parseFraction = [](const std::string& fractionStr) -> double {
+            size_t pos = fractionStr.find('/');
+            if (pos != std::string::npos) {
+                double numerator = std::stod(fractionStr.substr(0, pos));
+                double denominator = std::stod(fractionStr.substr(pos + 1));
+                return numerator / denominator;
+            }
+            return std::stod(fractionStr);
+            };
+
+        if (keyphrase == "default") {
+            return cv::Rect(0, 0, imageSize.width, imageSize.height);
+        }
+
+        std::istringstream ss(keyphrase);
+        std::string direction;
+        std::string fractionStr;
+
+        cv::Rect roi(0, 0, imageSize.width, imageSize.height);
+
+        while (ss >> direction >> fractionStr) {
+            double fraction = parseFraction(fractionStr);
+            int width = imageSize.width;
+            int height = imageSize.height;
+
+            if (direction == "right") {
+                int newWidth = width * fraction;
+                int newX = width - newWidth;
+                roi = cv::Rect(newX, roi.y, newWidth, roi.height);
+            }
+            else if (direction == "left") {
+                int newWidth = width * fraction;
+                roi = cv::Rect(roi.x, roi.y, newWidth, roi.height);
+            }
+            else if (direction == "bottom") {
+                int newHeight = height * fraction;
+                int newY = height - newHeight;
+                roi = cv::Rect(roi.x, newY, roi.width, newHeight);
+            }
+            else if (direction == "top") {
+                int newHeight = height * fraction;
+                roi = cv::Rect(roi.x, roi.y, roi.width, newHeight);
+            }
+            else if (direction == "center") {
+                int newWidth = width * fraction;
+                int newHeight = height * fraction;
+                int newX = (width - newWidth) / 2;
+                int newY = (height - newHeight) / 2;
+                roi = cv::Rect(newX, newY, newWidth, newHeight);
+            }
+            else {
+                logFailure(ErrorCode::InvalidDirection, "getRoiFromKeyphrase");
+                return cv::Rect(0, 0, width, height);
+            }
+        }
+
+        roi.x = (roi.x > 0) ? roi.x : 0;
+        roi.y = (roi.y > 0) ? roi.y : 0;
+        roi.width = (roi.width < imageSize.width - roi.x) ? roi.width : imageSize.width - roi.x;
+        roi.height = (roi.height < imageSize.height - roi.y) ? roi.height : imageSize.height - roi.y;
+
+        return roi;
+    }
+    
+private:
+    static constexpr size_t kFFTMinTemplateArea = 64 * 64;
+
+    static bool rowDiffers(const uchar* a, const uchar* b, int bytes, int tolerance) {
+        if (tolerance == 0) {
+            return std::memcmp(a, b, bytes) != 0;
+        }
+        static const RowDiffersFn differs = CpuDispatch::Kernel<RowDiffersFn>{
+            &rowDiffersBaseline, IP_AVX2_KERNEL(rowDiffersAVX2), IP_AVX512_KERNEL(rowDiffersAVX512) }.select();
+        return differs(a, b, bytes, tolerance);
+    }
+
+    // Splits one scan line into a leading fill part and a trailing empty part. Runs of fill and
+    // empty pixels are collected first; the split goes at the run boundary with the fewest
+    // disagreeing pixels. Returns false when the line has no fill or empty pixels at all.
+    static bool gaugeEdge(const std::vector<const uchar*>& pixels, const GaugeSpec& spec, double& edge, int& agree, int& total) {
+        struct Run {
+            int start;
+            int length;
+            bool fill;
+        };
+        auto distance = [](const uchar* pixel, const cv::Vec3b& colour) {
+            return std::abs(pixel[0] - colour[0]) + std::abs(pixel[1] - colour[1]) + std::abs(pixel[2] - colour[2]);
+        };
+        auto within = [&](const uchar* pixel, const cv::Vec3b& colour) {
+            return std::abs(pixel[0] - colour[0]) <= spec.tolerance &&
+                std::abs(pixel[1] - colour[1]) <= spec.tolerance &&
+                std::abs(pixel[2] - colour[2]) <= spec.tolerance;
+        };
+
+        std::vector<Run> runs;
+        int fillTotal = 0, emptyTotal = 0;
+        for (int i = 0; i < static_cast<int>(pixels.size()); ++i) {
+            bool fill = within(pixels[i], spec.fillColour);
+            if (!fill && !within(pixels[i], spec.emptyColour)) {
+                continue;
+            }
+            (fill ? fillTotal : emptyTotal) += 1;
+            if (!runs.empty() && runs.back().fill == fill && runs.back().start + runs.back().length == i) {
+                ++runs.back().length;
+            }
+            else {
+                runs.push_back({ i, 1, fill });
+            }
+        }
+        if (runs.empty()) {
+            return false;
+        }
+
+        // Split before run k: empty pixels before it and fill pixels from it on disagree.
+        int bestRun = 0, bestCost = fillTotal;
+        int emptyBefore = 0, fillBefore = 0;
+        for (size_t k = 0; k < runs.size(); ++k) {
+            (runs[k].fill ? fillBefore : emptyBefore) += runs[k].length;
+            int cost = emptyBefore + (fillTotal - fillBefore);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestRun = static_cast<int>(k) + 1;
+            }
+        }
+
+        total = fillTotal + emptyTotal;
+        agree = total - bestCost;
+        if (bestRun == 0) {
+            edge = 0.0;
+            return true;
+        }
+        const Run& last = runs[bestRun - 1];
+        edge = last.start + last.length;
+        const int next = static_cast<int>(edge);
+        if (next < static_cast<int>(pixels.size())) {
+            const int toFill = distance(pixels[next], spec.fillColour);
+            const int toEmpty = distance(pixels[next], spec.emptyColour);
+            if (toFill + toEmpty > 0) {
+                edge += static_cast<double>(toEmpty) / (toFill + toEmpty);
+            }
+        }
+        if (bestRun == static_cast<int>(runs.size())) {
+            edge = std::max(edge, static_cast<double>(pixels.size()));
+        }
+        return true;
+    }
+
+    static constexpr char kRecordingMagic[8] = { 'I', 'P', 'R', 'E', 'C', '0', '0', '1' };
+    static constexpr uint32_t kFrameMagic = 0x52464950u;
+    static constexpr size_t kTileFrameHeaderBytes = 8 + 8 + 1 + 4 * 3 + 4;
+
+    template<typename T>
+    static void writeValue(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    static bool readValue(std::istream& in, T& value) {
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    template<typename T>
+    static void appendValue(std::vector<uchar>& out, const T& value) {
+        const uchar* bytes = reinterpret_cast<const uchar*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    static bool takeValue(const uchar*& in, const uchar* end, T& value) {
+        if (static_cast<size_t>(end - in) < sizeof(T)) {
+            return false;
+        }
+        std::memcpy(&value, in, sizeof(T));
+        in += sizeof(T);
+        return true;
+    }
+
+    static constexpr uint32_t kMatchRequestMagic = 0x514D5049u;
+    static constexpr uint32_t kMatchResponseMagic = 0x524D5049u;
+    static constexpr uint16_t kMatchProtocolVersion = 1;
+    static constexpr uint32_t kOpMatch = 1;
+    static constexpr uint32_t kOpListTemplates = 2;
+    static constexpr uint8_t kFrameShared = 0;
+    static constexpr uint8_t kFrameAttached = 1;
+    static constexpr uint8_t kFrameFromPath = 2;
+    static constexpr size_t kMatchHeaderBytes = 14;
+    static constexpr size_t kMatchResultBytes = 29;
+    static constexpr uint32_t kMaxMatchPayload = 1u << 20;
+    static constexpr uint32_t kMaxMatchIds = static_cast<uint32_t>((kMaxMatchPayload - sizeof(uint32_t)) / kMatchResultBytes);
+
+    static bool isMatchFrameType(int type) {
+        return type == CV_8UC1 || type == CV_8UC3 || type == CV_8UC4;
+    }
+
+    static void appendMatchMessage(std::vector<uchar>& out, uint32_t magic, uint32_t op, const std::vector<uchar>& payload) {
+        appendValue(out, magic);
+        appendValue(out, kMatchProtocolVersion);
+        appendValue(out, op);
+        appendValue(out, static_cast<uint32_t>(payload.size()));
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+
+    // Parses a message header and leaves in at the payload; false on a foreign or oversized one.
+    static bool takeMatchHeader(const uchar*& in, const uchar* end, uint32_t expectedMagic, uint32_t& op, uint32_t& length) {
+        uint32_t magic;
+        uint16_t version;
+        return takeValue(in, end, magic) && takeValue(in, end, version) && takeValue(in, end, op) && takeValue(in, end, length) &&
+            magic == expectedMagic && version == kMatchProtocolVersion && length <= kMaxMatchPayload;
+    }
+
+    #ifdef __linux__
+    // Blocking send of one message, attaching passFd with SCM_RIGHTS when it is valid.
+    static bool writeMatchMessage(int socketFd, uint32_t magic, uint32_t op, const std::vector<uchar>& payload, int passFd) {
+        std::vector<uchar> message;
+        message.reserve(kMatchHeaderBytes + payload.size());
+        appendMatchMessage(message, magic, op, payload);
+
+        size_t sent = 0;
+        while (sent < message.size()) {
+            iovec part = { message.data() + sent, message.size() - sent };
+            msghdr header = {};
+            header.msg_iov = &part;
+            header.msg_iovlen = 1;
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+            if (sent == 0 && passFd >= 0) {
+                header.msg_control = control;
+                header.msg_controllen = sizeof(control);
+                cmsghdr* rights = CMSG_FIRSTHDR(&header);
+                rights->cmsg_level = SOL_SOCKET;
+                rights->cmsg_type = SCM_RIGHTS;
+                rights->cmsg_len = CMSG_LEN(sizeof(int));
+                std::memcpy(CMSG_DATA(rights), &passFd, sizeof(int));
+            }
+            ssize_t written = sendmsg(socketFd, &header, MSG_NOSIGNAL);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            sent += static_cast<size_t>(written);
+        }
+        return true;
+    }
+
+    static bool readExactly(int socketFd, uchar* data, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t got = recv(socketFd, data + done, size - done, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            done += static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    // Blocking read of one complete message.
+    static bool readMatchMessage(int socketFd, uint32_t expectedMagic, uint32_t& op, std::vector<uchar>& payload) {
+        uchar head[kMatchHeaderBytes];
+        if (!readExactly(socketFd, head, sizeof(head))) {
+            return false;
+        }
+        const uchar* in = head;
+        uint32_t length;
+        if (!takeMatchHeader(in, head + sizeof(head), expectedMagic, op, length)) {
+            return false;
+        }
+        payload.resize(length);
+        return readExactly(socketFd, payload.data(), length);
+    }
+    #endif
+
+    static cv::Rect tileRect(int tile, const cv::Size& size, int tileSize) {
+        const int columns = (size.width + tileSize - 1) / tileSize;
+        return cv::Rect((tile % columns) * tileSize, (tile / columns) * tileSize, tileSize, tileSize) &
+            cv::Rect(0, 0, size.width, size.height);
+    }
+
+    // Copies the tiles of current that differ from previous, or all of them when previous is
+    // empty or differently shaped.
+    static std::vector<std::pair<int, cv::Mat>> collectTiles(const cv::Mat& previous, const cv::Mat& current, int tileSize) {
+        DirtyTileMap dirty = diffFrames(previous, current, tileSize);
+        std::vector<std::pair<int, cv::Mat>> tiles;
+        for (int tile = 0; tile < static_cast<int>(dirty.tiles.size()); ++tile) {
+            if (dirty.tiles[tile]) {
+                tiles.emplace_back(tile, current(tileRect(tile, current.size(), tileSize)).clone());
+            }
+        }
+        return tiles;
+    }
+
+    // Brings a reference frame up to date from collectTiles output without copying unchanged tiles.
+    static void applyTiles(cv::Mat& reference, const cv::Size& size, int type, const std::vector<std::pair<int, cv::Mat>>& tiles, int tileSize) {
+        reference.create(size, type);
+        for (const auto& tile : tiles) {
+            tile.second.copyTo(reference(tileRect(tile.first, size, tileSize)));
+        }
+    }
+
+    static std::vector<uchar> encodeTileFrame(const TileFrame& frame) {
+        std::vector<uchar> out;
+        appendValue(out, frame.index);
+        appendValue(out, frame.timestampUs);
+        appendValue(out, static_cast<uint8_t>(frame.key));
+        appendValue(out, static_cast<int32_t>(frame.size.width));
+        appendValue(out, static_cast<int32_t>(frame.size.height));
+        appendValue(out, static_cast<int32_t>(frame.type));
+        appendValue(out, static_cast<uint32_t>(frame.tiles.size()));
+        for (const auto& tile : frame.tiles) {
+            appendValue(out, static_cast<uint32_t>(tile.first));
+            const size_t lengthAt = out.size();
+            appendValue(out, uint32_t(0));
+            encodeTile(tile.second, out);
+            const uint32_t length = static_cast<uint32_t>(out.size() - lengthAt - sizeof(uint32_t));
+            std::memcpy(out.data() + lengthAt, &length, sizeof(length));
+        }
+        return out;
+    }
+
+    static bool decodeTileFrameHeader(const uchar* data, size_t size, TileFrame& frame) {
+        const uchar* in = data;
+        const uchar* end = data + size;
+        uint8_t key;
+        int32_t width, height, type;
+        uint32_t count;
+        if (!takeValue(in, end, frame.index) || !takeValue(in, end, frame.timestampUs) || !takeValue(in, end, key) ||
+            !takeValue(in, end, width) || !takeValue(in, end, height) || !takeValue(in, end, type) || !takeValue(in, end, count)) {
+            return false;
+        }
+        frame.key = key != 0;
+        frame.size = cv::Size(width, height);
+        frame.type = type;
+        return width > 0 && height > 0;
+    }
+
+    // Decodes a frame record into image, which must already hold the previous frame unless the
+    // record is a keyframe. The changed tile rects go to damage when given.
+    static bool decodeTileFrame(const uchar* data, size_t size, int tileSize, cv::Mat& image, std::vector<cv::Rect>* damage) {
+        TileFrame header;
+        if (size < kTileFrameHeaderBytes || !decodeTileFrameHeader(data, size, header)) {
+            return false;
+        }
+        if (header.key) {
+            image.create(header.size, header.type);
+        }
+        else if (image.size() != header.size || image.type() != header.type) {
+            return false;
+        }
+        const uchar* in = data + kTileFrameHeaderBytes;
+        const uchar* end = data + size;
+        uint32_t count;
+        std::memcpy(&count, data + kTileFrameHeaderBytes - sizeof(uint32_t), sizeof(count));
+        if (damage) {
+            damage->clear();
+        }
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t tile, length;
+            if (!takeValue(in, end, tile) || !takeValue(in, end, length) || static_cast<size_t>(end - in) < length) {
+                return false;
+            }
+            cv::Rect rect = tileRect(static_cast<int>(tile), header.size, tileSize);
+            cv::Mat target = image(rect);
+            if (rect.empty() || !decodeTile(in, length, target)) {
+                return false;
+            }
+            in += length;
+            if (damage) {
+                damage->push_back(rect);
+            }
+        }
+        return true;
+    }
+
+    // QOI-style lossless tile coding: runs of the previous pixel, a 64-entry cache of recent
+    // pixels, and small per-channel deltas, falling back to raw pixels. Works on 8-bit images
+    // with 1 to 4 channels; missing channels are coded as zero (alpha as 255).
+    static void encodeTile(const cv::Mat& tile, std::vector<uchar>& out) {
+        const int cn = tile.channels();
+        std::array<std::array<uchar, 4>, 64> seen = {};
+        std::array<uchar, 4> previous = { 0, 0, 0, 255 };
+        int run = 0;
+        for (int y = 0; y < tile.rows; ++y) {
+            const uchar* row = tile.ptr<uchar>(y);
+            for (int x = 0; x < tile.cols; ++x, row += cn) {
+                std::array<uchar, 4> pixel = { row[0], cn > 1 ? row[1] : uchar(0), cn > 2 ? row[2] : uchar(0), cn > 3 ? row[3] : uchar(255) };
+                if (pixel == previous) {
+                    if (++run == 62) {
+                        out.push_back(static_cast<uchar>(0xC0 | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0) {
+                    out.push_back(static_cast<uchar>(0xC0 | (run - 1)));
+                    run = 0;
+                }
+                const int slot = pixelSlot(pixel);
+                if (seen[slot] == pixel) {
+                    out.push_back(static_cast<uchar>(slot));
+                }
+                else {
+                    seen[slot] = pixel;
+                    const int d0 = static_cast<int8_t>(pixel[0] - previous[0]);
+                    const int d1 = static_cast<int8_t>(pixel[1] - previous[1]);
+                    const int d2 = static_cast<int8_t>(pixel[2] - previous[2]);
+                    const int d10 = d0 - d1, d12 = d2 - d1;
+                    if (pixel[3] != previous[3]) {
+                        out.insert(out.end(), { uchar(0xFF), pixel[0], pixel[1], pixel[2], pixel[3] });
+                    }
+                    else if (d0 >= -2 && d0 <= 1 && d1 >= -2 && d1 <= 1 && d2 >= -2 && d2 <= 1) {
+                        out.push_back(static_cast<uchar>(0x40 | ((d0 + 2) << 4) | ((d1 + 2) << 2) | (d2 + 2)));
+                    }
+                    else if (d1 >= -32 && d1 <= 31 && d10 >= -8 && d10 <= 7 && d12 >= -8 && d12 <= 7) {
+                        out.push_back(static_cast<uchar>(0x80 | (d1 + 32)));
+                        out.push_back(static_cast<uchar>(((d10 + 8) << 4) | (d12 + 8)));
+                    }
+                    else {
+                        out.insert(out.end(), { uchar(0xFE), pixel[0], pixel[1], pixel[2] });
+                    }
+                }
+                previous = pixel;
+            }
+        }
+        if (run > 0) {
+            out.push_back(static_cast<uchar>(0xC0 | (run - 1)));
+        }
+    }
+
+    static bool decodeTile(const uchar* in, size_t length, cv::Mat& tile) {
+        const uchar* end = in + length;
+        const int cn = tile.channels();
+        std::array<std::array<uchar, 4>, 64> seen = {};
+        std::array<uchar, 4> pixel = { 0, 0, 0, 255 };
+        int run = 0;
+        for (int y = 0; y < tile.rows; ++y) {
+            uchar* row = tile.ptr<uchar>(y);
+            for (int x = 0; x < tile.cols; ++x, row += cn) {
+                if (run > 0) {
+                    --run;
+                }
+                else {
+                    if (in >= end) {
+                        return false;
+                    }
+                    const uchar op = *in++;
+                    if (op == 0xFE || op == 0xFF) {
+                        const size_t bytes = op == 0xFE ? 3 : 4;
+                        if (static_cast<size_t>(end - in) < bytes) {
+                            return false;
+                        }
+                        std::copy(in, in + bytes, pixel.begin());
+                        in += bytes;
+                        seen[pixelSlot(pixel)] = pixel;
+                    }
+                    else if ((op & 0xC0) == 0x00) {
+                        pixel = seen[op];
+                    }
+                    else if ((op & 0xC0) == 0x40) {
+                        pixel[0] = static_cast<uchar>(pixel[0] + ((op >> 4) & 3) - 2);
+                        pixel[1] = static_cast<uchar>(pixel[1] + ((op >> 2) & 3) - 2);
+                        pixel[2] = static_cast<uchar>(pixel[2] + (op & 3) - 2);
+                        seen[pixelSlot(pixel)] = pixel;
+                    }
+                    else if ((op & 0xC0) == 0x80) {
+                        if (in >= end) {
+                            return false;
+                        }
+                        const int d1 = (op & 0x3F) - 32;
+                        const uchar second = *in++;
+                        pixel[0] = static_cast<uchar>(pixel[0] + d1 + (second >> 4) - 8);
+                        pixel[1] = static_cast<uchar>(pixel[1] + d1);
+                        pixel[2] = static_cast<uchar>(pixel[2] + d1 + (second & 0x0F) - 8);
+                        seen[pixelSlot(pixel)] = pixel;
+                    }
+                    else {
+                        run = op & 0x3F;
+                    }
+                }
+                for (int c = 0; c < cn; ++c) {
+                    row[c] = pixel[c];
+                }
+            }
+        }
+        return true;
+    }
+
+    static int pixelSlot(const std::array<uchar, 4>& pixel) {
+        return (pixel[0] * 3 + pixel[1] * 5 + pixel[2] * 7 + pixel[3] * 11) % 64;
+    }
+
+    // Joins horizontal runs of dirty tiles, then stacks runs with identical spans on consecutive rows.
+    static std::vector<cv::Rect> mergeDirtyTiles(const DirtyTileMap& map) {
+        const cv::Rect frame(cv::Point(0, 0), map.frameSize);
+        std::vector<cv::Rect> merged, open;
+        for (int ty = 0; ty < map.grid.height; ++ty) {
+            std::vector<cv::Rect> next;
+            for (int tx = 0; tx < map.grid.width; ++tx) {
+                if (!map.isDirty(tx, ty)) {
+                    continue;
+                }
+                int end = tx;
+                while (end + 1 < map.grid.width && map.isDirty(end + 1, ty)) {
+                    ++end;
+                }
+                cv::Rect run(tx * map.tileSize, ty * map.tileSize, (end - tx + 1) * map.tileSize, map.tileSize);
+                auto above = std::find_if(open.begin(), open.end(), [&](const cv::Rect& r) {
+                    return r.x == run.x && r.width == run.width;
+                });
+                if (above != open.end()) {
+                    run.y = above->y;
+                    run.height += above->height;
+                    open.erase(above);
+                }
+                next.push_back(run);
+                tx = end;
+            }
+            for (const cv::Rect& r : open) {
+                merged.push_back(r & frame);
+            }
+            open = std::move(next);
+        }
+        for (const cv::Rect& r : open) {
+            merged.push_back(r & frame);
+        }
+        return merged;
+    }
+
+    static Result<cv::Mat> estimateHomographyORB(const cv::Mat& largeImage, const cv::Mat& smallImage,
+        const std::vector<cv::KeyPoint>& keypointsLarge, const cv::Mat& descriptorsLarge,
+        const std::vector<cv::KeyPoint>& keypointsSmall, const cv::Mat& descriptorsSmall,
+        int minMatchScore, bool debug) {
+        cv::BFMatcher matcher(cv::NORM_HAMMING, true);
+        std::vector<cv::DMatch> matches;
+        matcher.match(descriptorsSmall, descriptorsLarge, matches);
+
+        if (matches.empty()) {
+            return Result<cv::Mat>::failure(ErrorCode::NoMatches);
+        }
+
+        float minDistance = std::min_element(matches.begin(), matches.end(),
+            [](const cv::DMatch& a, const cv::DMatch& b) {
+                return a.distance < b.distance;
+            })->distance;
+
+        float maxAcceptableDistance = minDistance + (minMatchScore / 256.0f * 256.0f);
+        std::vector<cv::DMatch> goodMatches;
+        std::copy_if(matches.begin(), matches.end(), std::back_inserter(goodMatches),
+            [maxAcceptableDistance](const cv::DMatch& m) {
+                return m.distance <= maxAcceptableDistance;
+            });
+
+        std::unique_ptr<DebugRecord> record;
+        if (debug && DebugSink::instance().accepting()) {
+            record.reset(new DebugRecord("orb", largeImage, smallImage));
+            record->keypointsLarge = keypointsLarge;
+            record->keypointsSmall = keypointsSmall;
+            record->matches = goodMatches;
+            record->score = static_cast<double>(goodMatches.size());
+        }
+
+        const double matchScore = static_cast<double>(goodMatches.size());
+        if (goodMatches.size() < 4) {
+            if (record) {
+                DebugSink::instance().push(std::move(*record));
+            }
+            return Result<cv::Mat>::failure(ErrorCode::NotEnoughMatches, matchScore);
+        }
+
+        std::vector<cv::Point2f> pointsSmall, pointsLarge;
+        for (const auto& match : goodMatches) {
+            pointsSmall.push_back(keypointsSmall[match.queryIdx].pt);
+            pointsLarge.push_back(keypointsLarge[match.trainIdx].pt);
         }
-        CFRelease(windowList);
-        return 0;
-    }*/
 
-    static cv::Mat CGImageToMat(CGImageRef image) {
-        size_t width = CGImageGetWidth(image);
-        size_t height = CGImageGetHeight(image);
-        
-        cv::Mat mat(height, width, CV_8UC4);
-        
-        CGContextRef context = CGBitmapContextCreate(mat.data, width, height, 8, mat.step[0], 
-                                                    CGColorSpaceCreateDeviceRGB(), 
-                                                    kCGImageAlphaPremultipliedLast | kCGBitmapByteOrder32Big);
-        if (!context) {
-            throw std::runtime_error("Failed to create CGContext.");
+        cv::Mat homography = cv::findHomography(pointsSmall, pointsLarge, cv::RANSAC);
+
+        if (record) {
+            if (!homography.empty()) {
+                record->rects.push_back(projectedBounds(homography, smallImage.size()));
+            }
+            DebugSink::instance().push(std::move(*record));
         }
-        
-        CGContextDrawImage(context, CGRectMake(0, 0, width, height), image);
-        CGContextRelease(context);
-        
-        return mat;
+        if (homography.empty()) {
+            return Result<cv::Mat>::failure(ErrorCode::HomographyFailed, matchScore);
+        }
+        return Result<cv::Mat>(homography, matchScore);
     }
 
-    static void ClickAtPosition(int x, int y) {
-        CGPoint point = CGPointMake(x, y);
-        CGEventRef downEvent = CGEventCreateMouseEvent(NULL, kCGEventLeftMouseDown, point, CGMouseButton::kCGMouseButtonLeft);
-        CGEventRef upEvent = CGEventCreateMouseEvent(NULL, kCGEventLeftMouseUp, point, CGMouseButton::kCGMouseButtonLeft);
+    static Result<cv::Rect> matchORB(const cv::Mat& largeCopy, const cv::Mat& smallCopy, const ORBProfile& profile,
+        int minMatchScore, bool debug, cv::Mat* homographyOut) {
+        std::vector<cv::KeyPoint> keypointsLarge, keypointsSmall;
+        cv::Mat descriptorsLarge, descriptorsSmall;
 
-        CGEventPost(kCGHIDEventTap, downEvent);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
-        CGEventPost(kCGHIDEventTap, upEvent);
+        computeKeypointsAndDescriptors(largeCopy, keypointsLarge, descriptorsLarge, profile);
+        computeKeypointsAndDescriptors(smallCopy, keypointsSmall, descriptorsSmall, profile);
 
-        CFRelease(downEvent);
-        CFRelease(upEvent);
+        if (descriptorsLarge.empty() || descriptorsSmall.empty()) {
+            return Result<cv::Rect>::failure(ErrorCode::NoDescriptors);
+        }
+
+        Result<cv::Mat> homography = estimateHomographyORB(largeCopy, smallCopy, keypointsLarge, descriptorsLarge,
+            keypointsSmall, descriptorsSmall, minMatchScore, debug);
+
+        if (!homography) {
+            return Result<cv::Rect>::failure(homography.error(), homography.score());
+        }
+
+        cv::Rect boundingRect = projectedBounds(*homography, smallCopy.size());
+        if (!isAspectRatioClose(boundingRect, smallCopy, 0.2)) {
+            return Result<cv::Rect>::failure(ErrorCode::AspectMismatch, homography.score());
+        }
+        if (homographyOut) {
+            *homographyOut = *homography;
+        }
+        return Result<cv::Rect>(boundingRect, homography.score());
     }
 
-    #elif __linux__
-    XImage* CaptureScreen(Display* display, int x = 0, int y = 0, int width = 0, int height = 0) {
-        Window root = DefaultRootWindow(display);
-        XWindowAttributes attributes;
-        XGetWindowAttributes(display, root, &attributes);
+    typedef cv::Point (*IconKernel)(const cv::Mat& image, const cv::Mat& templ, int rowBegin, int rowEnd, uint64_t& bestSad);
 
-        if (width == 0) width = attributes.width;
-        if (height == 0) height = attributes.height;
+    struct IconKernelEntry {
+        int width, height, channels;
+        CpuDispatch::Kernel<IconKernel> kernel;
+    };
 
-        return XGetImage(display, root, x, y, width, height, AllPlanes, ZPixmap);
+#define IP_ICON_KERNEL(W, H, C) { W, H, C, { &iconKernel<W, H, C, SadBaseline>, \
+        IP_AVX2_KERNEL((iconKernelAVX2<W, H, C>)), IP_AVX512_KERNEL((iconKernelAVX512<W, H, C>)) } }
+
+    static IconKernel selectIconKernel(int width, int height, int channels) {
+        static const IconKernelEntry table[] = {
+            IP_ICON_KERNEL(16, 16, 1), IP_ICON_KERNEL(16, 16, 3),
+            IP_ICON_KERNEL(24, 24, 1), IP_ICON_KERNEL(24, 24, 3),
+            IP_ICON_KERNEL(32, 32, 1), IP_ICON_KERNEL(32, 32, 3),
+            IP_ICON_KERNEL(48, 48, 1), IP_ICON_KERNEL(48, 48, 3),
+        };
+        for (const IconKernelEntry& entry : table) {
+            if (entry.width == width && entry.height == height && entry.channels == channels) {
+                return entry.kernel.select();
+            }
+        }
+        return &iconKernelGeneric;
     }
 
-    Pixmap CaptureWindow(Display* display, Window window) {
-        XWindowAttributes attrs;
-        XGetWindowAttributes(display, window, &attrs);
+#undef IP_ICON_KERNEL
 
-        Pixmap pixmap = XCreatePixmap(display, window, attrs.width, attrs.height, attrs.depth);
-        if (!pixmap) {
-            throw std::runtime_error("Failed to create pixmap.");
+    // Template rows are copied into a fixed-size local block so every row loop has a compile-time
+    // trip count and unrolls completely. The row loop stops as soon as the partial SAD exceeds the
+    // best so far. Sad supplies the row kernel for one instruction set.
+    template<int W, int H, int C, typename Sad>
+    static IP_ALWAYS_INLINE cv::Point iconKernel(const cv::Mat& image, const cv::Mat& templ, int rowBegin, int rowEnd, uint64_t& bestSad) {
+        constexpr int RowBytes = W * C;
+        alignas(64) uchar block[H][RowBytes];
+        for (int ty = 0; ty < H; ++ty) {
+            std::memcpy(block[ty], templ.ptr<uchar>(ty), RowBytes);
         }
 
-        GC gc = XCreateGC(display, pixmap, 0, NULL);
-        XCopyArea(display, window, pixmap, gc, 0, 0, attrs.width, attrs.height, 0, 0);
-        XFreeGC(display, gc);
+        cv::Point best(0, rowBegin);
+        uint64_t bestValue = UINT64_MAX;
+        const int lastX = image.cols - W;
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int x = 0; x <= lastX; ++x) {
+                uint64_t sad = 0;
+                for (int ty = 0; ty < H && sad < bestValue; ++ty) {
+                    sad += Sad::template row<RowBytes>(image.ptr<uchar>(y + ty) + x * C, block[ty]);
+                }
+                if (sad < bestValue) {
+                    bestValue = sad;
+                    best = cv::Point(x, y);
+                }
+            }
+        }
+        bestSad = bestValue;
+        return best;
+    }
 
-        return pixmap;
+    static cv::Point iconKernelGeneric(const cv::Mat& image, const cv::Mat& templ, int rowBegin, int rowEnd, uint64_t& bestSad) {
+        static const RowSadFn rowSad = CpuDispatch::Kernel<RowSadFn>{
+            &SadBaseline::bytes, IP_AVX2_KERNEL(SadAVX2::bytes), IP_AVX512_KERNEL(SadAVX512::bytes) }.select();
+        const int cn = templ.channels();
+        const int rowBytes = templ.cols * cn;
+        cv::Point best(0, rowBegin);
+        uint64_t bestValue = UINT64_MAX;
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int x = 0; x <= image.cols - templ.cols; ++x) {
+                uint64_t sad = 0;
+                for (int ty = 0; ty < templ.rows && sad < bestValue; ++ty) {
+                    sad += rowSad(image.ptr<uchar>(y + ty) + x * cn, templ.ptr<uchar>(ty), rowBytes);
+                }
+                if (sad < bestValue) {
+                    bestValue = sad;
+                    best = cv::Point(x, y);
+                }
+            }
+        }
+        bestSad = bestValue;
+        return best;
     }
 
-    static Window FindWindowByTitle(Display* display, const std::string& title) {
-        Window root = DefaultRootWindow(display);
-        Window returnedRoot, returnedParent;
-        Window* children;
-        unsigned int numChildren;
+    // Per-ISA kernels. The baseline versions use OpenCV universal intrinsics and are compiled for
+    // whatever the build targets; the AVX2 and AVX-512 versions are compiled with target attributes
+    // and only reached through CpuDispatch after the CPU has been checked.
+    typedef bool (*RowDiffersFn)(const uchar* a, const uchar* b, int bytes, int tolerance);
+    typedef unsigned (*RowSadFn)(const uchar* a, const uchar* b, int bytes);
+    typedef unsigned (*HammingFn)(const uchar* a, const uchar* b, int bytes);
+    // Index of the first pixel whose B, G and R all lie within tolerance of colour when want is
+    // true, or of the first pixel that does not when want is false; -1 if there is none.
+    typedef int (*ColourRowFn)(const uchar* row, int pixels, int channels, const uchar* colour, int tolerance, bool want);
 
-        if (XQueryTree(display, root, &returnedRoot, &returnedParent, &children, &numChildren)) {
-            for (unsigned int i = 0; i < numChildren; ++i) {
-                char* windowTitle;
-                Atom name = XInternAtom(display, "WM_NAME", True);
-                if (XGetWindowProperty(display, children[i], name, 0, 1024, False, AnyPropertyType, 
-                                    &name, &format, &items, &bytes, (unsigned char**)&windowTitle) == Success) {
-                    if (windowTitle && title == windowTitle) {
-                        XFree(windowTitle);
-                        return children[i];
-                    }
-                    XFree(windowTitle);
-                }
+    static ColourRowFn colourRowKernel() {
+        static const ColourRowFn scan = CpuDispatch::Kernel<ColourRowFn>{
+            &colourRowBaseline, IP_AVX2_KERNEL(colourRowAVX2), IP_AVX512_KERNEL(colourRowAVX512) }.select();
+        return scan;
+    }
+
+    static bool rowDiffersBaseline(const uchar* a, const uchar* b, int bytes, int tolerance) {
+        int i = 0;
+#if CV_SIMD128
+        cv::v_uint8x16 peak = cv::v_setzero_u8();
+        for (; i <= bytes - 16; i += 16) {
+            peak = cv::v_max(peak, cv::v_absdiff(cv::v_load(a + i), cv::v_load(b + i)));
+        }
+        if (cv::v_reduce_max(peak) > tolerance) {
+            return true;
+        }
+#endif
+        for (; i < bytes; ++i) {
+            if (std::abs(a[i] - b[i]) > tolerance) {
+                return true;
             }
         }
-        return 0;
+        return false;
     }
 
-    static cv::Mat XImageToMat(XImage* xImage) {
-        int width = xImage->width;
-        int height = xImage->height;
+    struct SadBaseline {
+        template<int Bytes>
+        static inline unsigned row(const uchar* a, const uchar* b) {
+            return bytes(a, b, Bytes);
+        }
 
-        cv::Mat mat(height, width, CV_8UC4);
+        static inline unsigned bytes(const uchar* a, const uchar* b, int n) {
+            unsigned sum = 0;
+            int i = 0;
+#if CV_SIMD128
+            for (; i + 16 <= n; i += 16) {
+                sum += cv::v_reduce_sad(cv::v_load(a + i), cv::v_load(b + i));
+            }
+#endif
+            for (; i < n; ++i) {
+                sum += static_cast<unsigned>(std::abs(a[i] - b[i]));
+            }
+            return sum;
+        }
+    };
 
-        memcpy(mat.data, xImage->data, height * xImage->bytes_per_line);
+    static unsigned hammingBaseline(const uchar* a, const uchar* b, int bytes) {
+        return static_cast<unsigned>(cv::hal::normHamming(a, b, bytes));
+    }
 
-        return mat;
+    static int colourRowBaseline(const uchar* row, int pixels, int channels, const uchar* colour, int tolerance, bool want) {
+        for (int x = 0; x < pixels; ++x, row += channels) {
+            const bool within = std::abs(row[0] - colour[0]) <= tolerance &&
+                std::abs(row[1] - colour[1]) <= tolerance &&
+                std::abs(row[2] - colour[2]) <= tolerance;
+            if (within == want) {
+                return x;
+            }
+        }
+        return -1;
     }
 
-    static void ClickAtPosition(int x, int y) {
-        Display* display = XOpenDisplay(NULL);
-        if (!display) {
-            std::cerr << "Cannot open display!" << std::endl;
-            return;
+#if IP_X86_DISPATCH
+    IP_TARGET_AVX2 static bool rowDiffersAVX2(const uchar* a, const uchar* b, int bytes, int tolerance) {
+        const __m256i limit = _mm256_set1_epi8(static_cast<char>(tolerance));
+        int i = 0;
+        for (; i + 32 <= bytes; i += 32) {
+            __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+            __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+            __m256i diff = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+            __m256i over = _mm256_subs_epu8(diff, limit);
+            if (!_mm256_testz_si256(over, over)) {
+                return true;
+            }
         }
+        return i < bytes && rowDiffersBaseline(a + i, b + i, bytes - i, tolerance);
+    }
 
-        XWarpPointer(display, None, DefaultRootWindow(display), 0, 0, 0, 0, x, y);
-        XFlush(display);
+    IP_TARGET_AVX512 static bool rowDiffersAVX512(const uchar* a, const uchar* b, int bytes, int tolerance) {
+        const __m512i limit = _mm512_set1_epi8(static_cast<char>(tolerance));
+        int i = 0;
+        for (; i + 64 <= bytes; i += 64) {
+            __m512i va = _mm512_loadu_si512(a + i);
+            __m512i vb = _mm512_loadu_si512(b + i);
+            __m512i diff = _mm512_or_si512(_mm512_subs_epu8(va, vb), _mm512_subs_epu8(vb, va));
+            if (_mm512_test_epi8_mask(_mm512_subs_epu8(diff, limit), _mm512_set1_epi8(-1))) {
+                return true;
+            }
+        }
+        return i < bytes && rowDiffersAVX2(a + i, b + i, bytes - i, tolerance);
+    }
 
-        XEvent event;
-        event.xbutton.type = ButtonPress;
-        event.xbutton.button = Button1;
-        event.xbutton.root = DefaultRootWindow(display);
-        event.xbutton.subwindow = DefaultRootWindow(display);
-        event.xbutton.x = x;
-        event.xbutton.y = y;
-        event.xbutton.x_root = x;
-        event.xbutton.y_root = y;
-        event.xbutton.same_screen = True;
+    struct SadAVX2 {
+        template<int Bytes>
+        IP_TARGET_AVX2 static inline unsigned row(const uchar* a, const uchar* b) {
+            return bytes(a, b, Bytes);
+        }
 
-        XSendEvent(display, PointerWindow, True, ButtonPressMask, &event);
-        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        IP_TARGET_AVX2 static inline unsigned bytes(const uchar* a, const uchar* b, int n) {
+            __m256i acc = _mm256_setzero_si256();
+            int i = 0;
+            for (; i + 32 <= n; i += 32) {
+                acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i))));
+            }
+            if (i + 16 <= n) {
+                acc = _mm256_add_epi64(acc, _mm256_zextsi128_si256(_mm_sad_epu8(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)))));
+                i += 16;
+            }
+            __m128i sum = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+            unsigned total = static_cast<unsigned>(_mm_cvtsi128_si64(sum) + _mm_extract_epi64(sum, 1));
+            return i < n ? total + SadBaseline::bytes(a + i, b + i, n - i) : total;
+        }
+    };
 
-        event.xbutton.type = ButtonRelease;
-        XSendEvent(display, PointerWindow, True, ButtonReleaseMask, &event);
-        XFlush(display);
+    struct SadAVX512 {
+        template<int Bytes>
+        IP_TARGET_AVX512 static inline unsigned row(const uchar* a, const uchar* b) {
+            return bytes(a, b, Bytes);
+        }
 
-        XCloseDisplay(display);
+        IP_TARGET_AVX512 static inline unsigned bytes(const uchar* a, const uchar* b, int n) {
+            __m512i acc = _mm512_setzero_si512();
+            int i = 0;
+            for (; i + 64 <= n; i += 64) {
+                acc = _mm512_add_epi64(acc, _mm512_sad_epu8(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+            }
+            // Reduced through memory: GCC 12 warns that _mm512_reduce_add_epi64 reads an
+            // uninitialised vector.
+            alignas(64) uint64_t lanes[8];
+            _mm512_store_si512(lanes, acc);
+            unsigned total = 0;
+            for (uint64_t lane : lanes) {
+                total += static_cast<unsigned>(lane);
+            }
+            return i < n ? total + SadAVX2::bytes(a + i, b + i, n - i) : total;
+        }
+    };
+
+    template<int W, int H, int C>
+    IP_TARGET_AVX2 static cv::Point iconKernelAVX2(const cv::Mat& image, const cv::Mat& templ, int rowBegin, int rowEnd, uint64_t& bestSad) {
+        return iconKernel<W, H, C, SadAVX2>(image, templ, rowBegin, rowEnd, bestSad);
     }
-    #endif
-    
-    cv::Mat ByteArrayToMat(const std::vector<uchar>& byteArray) {
-        cv::Mat image = cv::imdecode(byteArray, cv::IMREAD_COLOR);
-        return image;
+
+    template<int W, int H, int C>
+    IP_TARGET_AVX512 static cv::Point iconKernelAVX512(const cv::Mat& image, const cv::Mat& templ, int rowBegin, int rowEnd, uint64_t& bestSad) {
+        return iconKernel<W, H, C, SadAVX512>(image, templ, rowBegin, rowEnd, bestSad);
     }
 
-    static void displayImage(const cv::Mat& image, const std::string& windowName) {
-        if (image.empty()) {
-            std::cerr << "Could not open or find the image!" << std::endl;
-            return;
+    IP_TARGET_AVX2 static unsigned hammingPopcnt(const uchar* a, const uchar* b, int bytes) {
+        unsigned total = 0;
+        int i = 0;
+        for (; i + 8 <= bytes; i += 8) {
+            uint64_t wa, wb;
+            std::memcpy(&wa, a + i, 8);
+            std::memcpy(&wb, b + i, 8);
+            total += static_cast<unsigned>(_mm_popcnt_u64(wa ^ wb));
         }
-        cv::namedWindow(windowName, cv::WINDOW_AUTOSIZE);
-        cv::imshow(windowName, image);
-        cv::waitKey(0);
+        for (; i < bytes; ++i) {
+            total += static_cast<unsigned>(_mm_popcnt_u32(static_cast<unsigned>(a[i] ^ b[i])));
+        }
+        return total;
     }
 
-    static cv::Mat getRegionOfInterest(const cv::Mat& image, const cv::Rect& roi) {
-        if (roi.x < 0 || roi.y < 0 || roi.width <= 0 || roi.height <= 0 ||
-            roi.x + roi.width > image.cols || roi.y + roi.height > image.rows) {
-            std::cerr << "Invalid ROI!" << std::endl;
-            return cv::Mat(); 
+    // BGRA pixels are compared as 32-bit lanes with the alpha byte masked off; other layouts use
+    // the baseline loop.
+    IP_TARGET_AVX2 static int colourRowAVX2(const uchar* row, int pixels, int channels, const uchar* colour, int tolerance, bool want) {
+        int x = 0;
+        if (channels == 4) {
+            const __m256i target = _mm256_set1_epi32(colour[0] | (colour[1] << 8) | (colour[2] << 16));
+            const __m256i limit = _mm256_set1_epi8(static_cast<char>(tolerance));
+            const __m256i colourBytes = _mm256_set1_epi32(0x00FFFFFF);
+            for (; x + 8 <= pixels; x += 8) {
+                __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x * 4));
+                __m256i diff = _mm256_or_si256(_mm256_subs_epu8(px, target), _mm256_subs_epu8(target, px));
+                __m256i over = _mm256_and_si256(_mm256_subs_epu8(diff, limit), colourBytes);
+                int hits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over, _mm256_setzero_si256())));
+                hits = want ? hits : hits ^ 0xFF;
+                if (hits) {
+                    return x + __builtin_ctz(static_cast<unsigned>(hits));
+                }
+            }
         }
-
-        cv::Mat roiImage = image(roi);
-        return roiImage;
+        int rest = colourRowBaseline(row + x * channels, pixels - x, channels, colour, tolerance, want);
+        return rest < 0 ? -1 : x + rest;
     }
 
-    static cv::Rect getRoiFromKeyphrase(const std::string& keyphrase, const cv::Size& imageSize) {
-        
-        auto parseFraction = [](const std::string& fractionStr) -> double {
-            size_t pos = fractionStr.find('/');
-            if (pos != std::string::npos) {
-                double numerator = std::stod(fractionStr.substr(0, pos));
-                double denominator = std::stod(fractionStr.substr(pos + 1));
-                return numerator / denominator;
+    IP_TARGET_AVX512 static int colourRowAVX512(const uchar* row, int pixels, int channels, const uchar* colour, int tolerance, bool want) {
+        int x = 0;
+        if (channels == 4) {
+            const __m512i target = _mm512_set1_epi32(colour[0] | (colour[1] << 8) | (colour[2] << 16));
+            const __m512i limit = _mm512_set1_epi8(static_cast<char>(tolerance));
+            const __m512i colourBytes = _mm512_set1_epi32(0x00FFFFFF);
+            for (; x + 16 <= pixels; x += 16) {
+                __m512i px = _mm512_loadu_si512(row + x * 4);
+                __m512i diff = _mm512_or_si512(_mm512_subs_epu8(px, target), _mm512_subs_epu8(target, px));
+                __m512i over = _mm512_and_si512(_mm512_subs_epu8(diff, limit), colourBytes);
+                __mmask16 hits = want ? _mm512_cmpeq_epi32_mask(over, _mm512_setzero_si512())
+                    : _mm512_cmpneq_epi32_mask(over, _mm512_setzero_si512());
+                if (hits) {
+                    return x + __builtin_ctz(static_cast<unsigned>(hits));
+                }
             }
-            return std::stod(fractionStr);
-            };
+        }
+        int rest = colourRowAVX2(row + x * channels, pixels - x, channels, colour, tolerance, want);
+        return rest < 0 ? -1 : x + rest;
+    }
+#endif
 
-        if (keyphrase == "default") {
-            return cv::Rect(0, 0, imageSize.width, imageSize.height);
+    static void logFailure(ErrorCode code, const char* where, double score = 0.0) {
+        Log::instance().report(code, where, score);
+    }
+
+    template<typename T>
+    static T valueOrLog(const Result<T>& result, T fallback, const char* where) {
+        if (result) {
+            return result.value();
         }
+        logFailure(result.error(), where, result.score());
+        return fallback;
+    }
 
-        std::istringstream ss(keyphrase);
-        std::string direction;
-        std::string fractionStr;
+    static cv::Rect searchArea(const Frame& frame, const cv::Rect& roi) {
+        cv::Rect bounds(0, 0, frame.image.cols, frame.image.rows);
+        return roi.empty() ? bounds : (roi & bounds);
+    }
 
-        cv::Rect roi(0, 0, imageSize.width, imageSize.height);
+    static cv::Rect projectedBounds(const cv::Mat& homography, const cv::Size& smallSize) {
+        std::vector<cv::Point2f> smallCorners = {
+            cv::Point2f(0, 0),
+            cv::Point2f(static_cast<float>(smallSize.width), 0),
+            cv::Point2f(static_cast<float>(smallSize.width), static_cast<float>(smallSize.height)),
+            cv::Point2f(0, static_cast<float>(smallSize.height))
+        };
 
-        while (ss >> direction >> fractionStr) {
-            double fraction = parseFraction(fractionStr);
-            int width = imageSize.width;
-            int height = imageSize.height;
+        std::vector<cv::Point2f> largeCorners(4);
+        cv::perspectiveTransform(smallCorners, largeCorners, homography);
 
-            if (direction == "right") {
-                int newWidth = width * fraction;
-                int newX = width - newWidth;
-                roi = cv::Rect(newX, roi.y, newWidth, roi.height);
-            }
-            else if (direction == "left") {
-                int newWidth = width * fraction;
-                roi = cv::Rect(roi.x, roi.y, newWidth, roi.height);
-            }
-            else if (direction == "bottom") {
-                int newHeight = height * fraction;
-                int newY = height - newHeight;
-                roi = cv::Rect(roi.x, newY, roi.width, newHeight);
-            }
-            else if (direction == "top") {
-                int newHeight = height * fraction;
-                roi = cv::Rect(roi.x, roi.y, roi.width, newHeight);
-            }
-            else if (direction == "center") {
-                int newWidth = width * fraction;
-                int newHeight = height * fraction;
-                int newX = (width - newWidth) / 2;
-                int newY = (height - newHeight) / 2;
-                roi = cv::Rect(newX, newY, newWidth, newHeight);
+        return cv::boundingRect(largeCorners);
+    }
+
+    static void detectUprightKeypoints(const cv::Mat& gray, const ORBProfile& profile, int limit, std::vector<cv::KeyPoint>& keypoints) {
+        keypoints.clear();
+        const double shrink = 1.0 / profile.scaleFactor;
+        double levelShare = limit * (1.0 - shrink) / (1.0 - std::pow(shrink, profile.levels));
+        double levelScale = 1.0;
+        cv::Mat level = gray;
+        std::vector<cv::KeyPoint> levelKeypoints;
+
+        for (int l = 0; l < profile.levels; ++l) {
+            if (l > 0) {
+                levelScale *= profile.scaleFactor;
+                cv::Size size(cvRound(gray.cols / levelScale), cvRound(gray.rows / levelScale));
+                if (size.width <= 2 * profile.edgeThreshold || size.height <= 2 * profile.edgeThreshold) {
+                    break;
+                }
+                cv::resize(gray, level, size, 0, 0, cv::INTER_LINEAR);
             }
-            else {
-                std::cerr << "Invalid direction: " << direction << std::endl;
-                return cv::Rect(0, 0, width, height);
+
+            cv::FAST(level, levelKeypoints, profile.fastThreshold, true);
+            cv::KeyPointsFilter::runByImageBorder(levelKeypoints, level.size(), profile.edgeThreshold);
+            cv::KeyPointsFilter::retainBest(levelKeypoints, std::max(cvRound(levelShare), 1));
+            levelShare *= shrink;
+
+            for (cv::KeyPoint& kp : levelKeypoints) {
+                kp.pt = kp.pt * levelScale;
+                kp.size = static_cast<float>(profile.patchSize * levelScale);
+                kp.angle = 0.0f;
+                kp.octave = l;
+                keypoints.push_back(kp);
             }
         }
+    }
 
-        roi.x = (roi.x > 0) ? roi.x : 0;
-        roi.y = (roi.y > 0) ? roi.y : 0;
-        roi.width = (roi.width < imageSize.width - roi.x) ? roi.width : imageSize.width - roi.x;
-        roi.height = (roi.height < imageSize.height - roi.y) ? roi.height : imageSize.height - roi.y;
+    static cv::Mat thumbnail(const cv::Mat& image, double& scale, int maxSide = 480) {
+        scale = 1.0;
+        if (image.empty()) {
+            return cv::Mat();
+        }
+        int side = std::max(image.cols, image.rows);
+        if (side <= maxSide) {
+            return image.clone();
+        }
+        scale = static_cast<double>(maxSide) / side;
+        cv::Mat small;
+        cv::resize(image, small, cv::Size(), scale, scale, cv::INTER_LINEAR);
+        return small;
+    }
 
-        return roi;
+    static cv::Mat grayView(const cv::Mat& image) {
+        if (image.channels() == 1) {
+            return image;
+        }
+        cv::Mat gray;
+        cv::cvtColor(image, gray, image.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+        return gray;
     }
-    
-private:
+
+    static cv::Rect unscaleRect(const cv::Rect& matchRect, double scale, const cv::Size& imageSize) {
+        int x = static_cast<int>(matchRect.x / scale);
+        int y = static_cast<int>(matchRect.y / scale);
+        int width = static_cast<int>(matchRect.width / scale);
+        int height = static_cast<int>(matchRect.height / scale);
+
+        x = (x < 0) ? 0 : (x + width > imageSize.width) ? imageSize.width - width : x;
+        y = (y < 0) ? 0 : (y + height > imageSize.height) ? imageSize.height - height : y;
+
+        return cv::Rect(x, y, width, height);
+    }
+
     static bool isAspectRatioClose(const cv::Rect& rect, const cv::Mat& smallImage, double tolerance = 0.1) {
         double rectAspectRatio = static_cast<double>(rect.width) / rect.height;
         double rectRotatedAspectRatio = static_cast<double>(rect.height) / rect.width;
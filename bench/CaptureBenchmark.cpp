@@ -0,0 +1,414 @@
+// Capture and input benchmark for the Linux paths of ImageProccessing.h.
+//
+// Runs against $DISPLAY, or starts its own Xvfb when $DISPLAY is unset or --xvfb is given, draws
+// known content at controlled change rates and prints one JSON document with throughput, latency
+// and CPU time per capture path. Drawing on the root window and synthetic clicks only happen
+// under the benchmark's own Xvfb, or on a real display with --allow-input.
+//
+// For the damage-driven sources latency is measured from change to capture: every paint uses a
+// new colour that encodes its sequence number, and the captured pixel is mapped back to the time
+// that paint reached the server. Other paths report the duration of each call.
+//
+// Build:
+//   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build --target capture_benchmark
+//
+// Usage:
+//   capture_benchmark [--xvfb] [--allow-input] [--seconds N] [--size WxH]
+
+#include "../ImageProccessing.h"
+
+#include <array>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    double threadCpuMs() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    }
+
+    double processCpuMs() {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    }
+
+    struct Measurement {
+        std::string name;
+        std::string changeRate;
+        std::string latencyKind = "call";
+        std::vector<double> latenciesMs;
+        double wallMs = 0.0;
+        double cpuMs = 0.0;
+        bool skipped = false;
+        std::string note;
+    };
+
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) {
+            return 0.0;
+        }
+        size_t k = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+        std::nth_element(values.begin(), values.begin() + k, values.end());
+        return values[k];
+    }
+
+    // Repaints a rectangle of the root window at a fixed rate from its own X connection, so the
+    // capture paths see a known amount of change per second. Paint n uses colour n, and the time
+    // the server finished it is kept so a captured colour can be turned back into a latency.
+    class Painter {
+    public:
+        static constexpr int kOrigin = 16;
+
+        Painter(const char* displayName, cv::Size area, double hz)
+            : area_(area), hz_(hz) {
+            thread_ = std::thread([this, name = std::string(displayName)] { run(name); });
+        }
+
+        ~Painter() {
+            stop_ = true;
+            thread_.join();
+        }
+
+        // Milliseconds from the paint shown at the origin of image to captured, or a negative
+        // value when the pixel does not belong to a recent paint.
+        double latencyMs(const cv::Mat& image, Clock::time_point captured) const {
+            if (image.type() != CV_8UC4 || image.cols <= kOrigin || image.rows <= kOrigin) {
+                return -1.0;
+            }
+            const cv::Vec4b pixel = image.at<cv::Vec4b>(kOrigin, kOrigin);
+            const uint32_t colour = pixel[0] | (pixel[1] << 8) | (pixel[2] << 16);
+            const uint32_t latest = sequence_.load();
+            const uint32_t age = (latest - colour) & 0xFFFFFF;
+            if (colour == 0 || age >= kHistory) {
+                return -1.0;
+            }
+            const int64_t painted = paintedNs_[colour % kHistory].load();
+            return std::chrono::duration<double, std::milli>(captured.time_since_epoch() - std::chrono::nanoseconds(painted)).count();
+        }
+
+    private:
+        static constexpr uint32_t kHistory = 1024;
+
+        void run(const std::string& name) {
+            Display* display = XOpenDisplay(name.c_str());
+            if (!display) {
+                return;
+            }
+            Window root = DefaultRootWindow(display);
+            GC gc = XCreateGC(display, root, 0, NULL);
+            const auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz_));
+            auto next = Clock::now();
+            uint32_t colour = 0;
+            while (!stop_) {
+                colour = (colour + 1) & 0xFFFFFF;
+                colour = colour ? colour : 1;
+                XSetForeground(display, gc, colour);
+                XFillRectangle(display, root, gc, kOrigin, kOrigin, area_.width, area_.height);
+                XSync(display, False);
+                paintedNs_[colour % kHistory] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+                sequence_ = colour;
+                next += period;
+                std::this_thread::sleep_until(next);
+            }
+            XFreeGC(display, gc);
+            XCloseDisplay(display);
+        }
+
+        cv::Size area_;
+        double hz_;
+        std::atomic<bool> stop_{ false };
+        std::atomic<uint32_t> sequence_{ 0 };
+        std::array<std::atomic<int64_t>, kHistory> paintedNs_{};
+        std::thread thread_;
+    };
+
+    template<typename Body>
+    Measurement measure(const std::string& name, const std::string& changeRate, double seconds, Body body) {
+        Measurement result;
+        result.name = name;
+        result.changeRate = changeRate;
+        const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        const auto wallStart = Clock::now();
+        const double cpuStart = threadCpuMs();
+        while (Clock::now() < end) {
+            const auto start = Clock::now();
+            if (!body()) {
+                continue;
+            }
+            result.latenciesMs.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        }
+        result.cpuMs = threadCpuMs() - cpuStart;
+        result.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - wallStart).count();
+        return result;
+    }
+
+    // Waits for frames from source and records, for each, the time from the paint it shows to
+    // its capture.
+    Measurement measureChange(const std::string& name, const std::string& changeRate, double seconds,
+        IP::FrameSource& source, const Painter& painter) {
+        Measurement result;
+        result.name = name;
+        result.changeRate = changeRate;
+        result.latencyKind = "change_to_capture";
+        const auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+        const auto wallStart = Clock::now();
+        const double cpuStart = threadCpuMs();
+        while (Clock::now() < end) {
+            if (!source.next(Clock::now() + std::chrono::milliseconds(250))) {
+                continue;
+            }
+            double latency = painter.latencyMs(source.frame().image, source.frame().timestamp);
+            if (latency >= 0.0) {
+                result.latenciesMs.push_back(latency);
+            }
+        }
+        result.cpuMs = threadCpuMs() - cpuStart;
+        result.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - wallStart).count();
+        return result;
+    }
+
+    Measurement skipped(const std::string& name, const std::string& note) {
+        Measurement result;
+        result.name = name;
+        result.skipped = true;
+        result.note = note;
+        return result;
+    }
+
+    std::string jsonEscape(const std::string& text) {
+        std::string out;
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += static_cast<char>(c);
+            }
+            else if (c < 0x20) {
+                char code[8];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                out += code;
+            }
+            else {
+                out += static_cast<char>(c);
+            }
+        }
+        return out;
+    }
+
+    void printJson(const std::string& display, bool xvfb, cv::Size size, const std::vector<Measurement>& results, double processCpu) {
+        std::printf("{\n  \"display\": \"%s\",\n  \"xvfb\": %s,\n  \"width\": %d,\n  \"height\": %d,\n",
+            jsonEscape(display).c_str(), xvfb ? "true" : "false", size.width, size.height);
+        std::printf("  \"cpu_dispatch\": \"%s\",\n  \"process_cpu_ms\": %.1f,\n  \"results\": [\n",
+            IP::CpuDispatch::name(IP::CpuDispatch::active()), processCpu);
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Measurement& m = results[i];
+            std::printf("    {\"name\": \"%s\"", jsonEscape(m.name).c_str());
+            if (m.skipped) {
+                std::printf(", \"skipped\": true, \"note\": \"%s\"}", jsonEscape(m.note).c_str());
+            }
+            else {
+                const double n = static_cast<double>(m.latenciesMs.size());
+                std::printf(", \"change_rate\": \"%s\", \"iterations\": %zu, \"per_second\": %.2f", jsonEscape(m.changeRate).c_str(),
+                    m.latenciesMs.size(), m.wallMs > 0.0 ? n * 1000.0 / m.wallMs : 0.0);
+                std::printf(", \"latency_kind\": \"%s\", \"latency_ms\": {", m.latencyKind.c_str());
+                std::printf("\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}",
+                    percentile(m.latenciesMs, 0.5), percentile(m.latenciesMs, 0.99), percentile(m.latenciesMs, 1.0));
+                std::printf(", \"cpu_ms_per_iteration\": %.3f, \"cpu_percent\": %.1f}",
+                    n > 0 ? m.cpuMs / n : 0.0, m.wallMs > 0.0 ? 100.0 * m.cpuMs / m.wallMs : 0.0);
+            }
+            std::printf("%s\n", i + 1 < results.size() ? "," : "");
+        }
+        std::printf("  ]\n}\n");
+    }
+
+    pid_t startXvfb(const std::string& name, cv::Size size) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            std::string screen = std::to_string(size.width) + "x" + std::to_string(size.height) + "x24";
+            execlp("Xvfb", "Xvfb", name.c_str(), "-screen", "0", screen.c_str(), "-nolisten", "tcp", "+extension", "RANDR",
+                static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        for (int attempt = 0; pid > 0 && attempt < 100; ++attempt) {
+            if (Display* display = XOpenDisplay(name.c_str())) {
+                XCloseDisplay(display);
+                return pid;
+            }
+            int status;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                return -1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        return -1;
+    }
+
+}
+
+int main(int argc, char** argv) {
+    bool useXvfb = std::getenv("DISPLAY") == nullptr;
+    bool allowInput = false;
+    double seconds = 2.0;
+    cv::Size size(1920, 1080);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--xvfb") {
+            useXvfb = true;
+        }
+        else if (arg == "--allow-input") {
+            allowInput = true;
+        }
+        else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (arg == "--size" && i + 1 < argc) {
+            std::sscanf(argv[++i], "%dx%d", &size.width, &size.height);
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--xvfb] [--allow-input] [--seconds N] [--size WxH]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    pid_t xvfb = -1;
+    std::string displayName = useXvfb ? std::string(":").append(std::to_string(90 + getpid() % 100)) : std::getenv("DISPLAY");
+    if (useXvfb) {
+        xvfb = startXvfb(displayName, size);
+        if (xvfb < 0) {
+            std::fprintf(stderr, "Could not start Xvfb on %s\n", displayName.c_str());
+            return 1;
+        }
+        setenv("DISPLAY", displayName.c_str(), 1);
+    }
+
+    Display* display = XOpenDisplay(displayName.c_str());
+    if (!display) {
+        std::fprintf(stderr, "Cannot open display %s\n", displayName.c_str());
+        return 1;
+    }
+    XWindowAttributes attributes;
+    XGetWindowAttributes(display, DefaultRootWindow(display), &attributes);
+    size = cv::Size(attributes.width, attributes.height);
+
+    IP ip;
+    std::vector<Measurement> results;
+    const cv::Size smallChange(64, 64);
+    const cv::Size largeChange(size.width / 2, size.height / 2);
+
+    results.push_back(measure("CaptureScreen+XImageToMat", "static", seconds, [&] {
+        XImage* image = ip.CaptureScreen(display);
+        if (!image) {
+            return false;
+        }
+        cv::Mat mat = IP::XImageToMat(image);
+        XDestroyImage(image);
+        return !mat.empty();
+    }));
+
+    // Painting and clicking would disturb a real desktop, so they need the benchmark's own Xvfb
+    // or an explicit opt-in.
+    const bool drive = useXvfb || allowInput;
+    const std::string noInput = "draws on or clicks the display; run with --xvfb or --allow-input";
+
+    if (drive) {
+        IP::PollingFrameSource source([&] {
+            XImage* image = ip.CaptureScreen(display);
+            if (!image) {
+                return cv::Mat();
+            }
+            cv::Mat mat = IP::XImageToMat(image).clone();
+            XDestroyImage(image);
+            return mat;
+        }, std::chrono::milliseconds(0));
+        source.next(Clock::now() + std::chrono::milliseconds(100));
+        Painter painter(displayName.c_str(), smallChange, 30.0);
+        results.push_back(measureChange("PollingFrameSource+diffFrames", "64x64@30Hz", seconds, source, painter));
+    }
+    else {
+        results.push_back(skipped("PollingFrameSource+diffFrames", noInput));
+    }
+
+#ifdef IP_HAVE_XDAMAGE
+    for (const auto& scenario : { std::make_pair(smallChange, std::string("64x64@30Hz")),
+                                  std::make_pair(largeChange, std::string("quarter-screen@30Hz")) }) {
+        if (!drive) {
+            results.push_back(skipped("DamageFrameSource", noInput));
+            continue;
+        }
+        try {
+            IP::DamageFrameSource source;
+            source.next(Clock::now());
+            Painter painter(displayName.c_str(), scenario.first, 30.0);
+            results.push_back(measureChange("DamageFrameSource", scenario.second, seconds, source, painter));
+        }
+        catch (const std::exception& error) {
+            results.push_back(skipped("DamageFrameSource", error.what()));
+        }
+    }
+
+    if (drive) {
+        try {
+            IP::DamageFrameSource inner;
+            IP::PacedFrameSource paced(inner, 20.0);
+            paced.next(Clock::now() + std::chrono::milliseconds(100));
+            Painter painter(displayName.c_str(), smallChange, 30.0);
+            results.push_back(measureChange("PacedFrameSource@20fps", "64x64@30Hz", seconds, paced, painter));
+        }
+        catch (const std::exception& error) {
+            results.push_back(skipped("PacedFrameSource@20fps", error.what()));
+        }
+    }
+    else {
+        results.push_back(skipped("PacedFrameSource@20fps", noInput));
+    }
+#else
+    results.push_back(skipped("DamageFrameSource", "built without Xdamage"));
+#endif
+
+#ifdef IP_HAVE_XRANDR
+    try {
+        IP::OutputCapture outputs;
+        results.push_back(measure("OutputCapture::capturePrimary", "static", seconds, [&] {
+            return outputs.capturePrimary().ok();
+        }));
+    }
+    catch (const std::exception& error) {
+        results.push_back(skipped("OutputCapture::capturePrimary", error.what()));
+    }
+#else
+    results.push_back(skipped("OutputCapture::capturePrimary", "built without Xrandr"));
+#endif
+
+    if (drive) {
+        results.push_back(measure("ClickAtPosition", "n/a", std::min(seconds, 1.0), [&] {
+            IP::ClickAtPosition(size.width / 2, size.height / 2);
+            return true;
+        }));
+    }
+    else {
+        results.push_back(skipped("ClickAtPosition", noInput));
+    }
+
+    XCloseDisplay(display);
+    printJson(displayName, useXvfb, size, results, processCpuMs());
+
+    if (xvfb > 0) {
+        kill(xvfb, SIGTERM);
+        waitpid(xvfb, nullptr, 0);
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Matching daemon built on IP::MatchServer.
+//
+// Loads every image in the template directory once, then answers match requests from
+// IP::MatchClient over a Unix domain socket until SIGINT or SIGTERM. The socket is only
+// accessible to the daemon's user. Requests naming an image path are refused unless
+// --allow-paths is given, since the daemon would open them with its own privileges.
+//
+// Build:
+//   cmake -S . -B build -DCMAKE_BUILD_TYPE=Release && cmake --build build --target ipmatchd
+//
+// Usage:
+//   ipmatchd [--allow-paths] <socket path> <template directory>
+
+#include "../ImageProccessing.h"
+
+#include <csignal>
+#include <cstdio>
+#include <string>
+
+namespace {
+
+    IP::MatchServer* server = nullptr;
+
+    void onSignal(int) {
+        if (server) {
+            server->stop();
+        }
+    }
+
+}
+
+int main(int argc, char** argv) {
+    const bool allowPaths = argc == 4 && std::string(argv[1]) == "--allow-paths";
+    if (argc != 3 && !allowPaths) {
+        std::fprintf(stderr, "usage: %s [--allow-paths] <socket path> <template directory>\n", argv[0]);
+        return 2;
+    }
+    const char* socketPath = argv[argc - 2];
+    const char* templateDirectory = argv[argc - 1];
+
+    try {
+        IP::MatchServer matchServer(socketPath, allowPaths);
+        matchServer.loadDirectory(templateDirectory);
+        std::fprintf(stderr, "ipmatchd: %zu templates, listening on %s\n", matchServer.templateCount(), socketPath);
+
+        server = &matchServer;
+        std::signal(SIGINT, onSignal);
+        std::signal(SIGTERM, onSignal);
+        std::signal(SIGPIPE, SIG_IGN);
+        matchServer.serve();
+        server = nullptr;
+    }
+    catch (const std::exception& error) {
+        std::fprintf(stderr, "ipmatchd: %s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
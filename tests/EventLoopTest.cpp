@@ -0,0 +1,90 @@
+// IP::EventLoop deadline timers: waits that resolve on a frame cancel their deadline, so the timer
+// heap drains instead of holding one entry per finished wait until the deadlines pass.
+
+#include "ImageProccessing.h"
+
+#include <cstdio>
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, const char* what) {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    const cv::Vec3b kMarker(10, 200, 30);
+
+    // Publishes a fully damaged frame with the marker pixel on every call.
+    class MarkerSource : public IP::FrameSource {
+    public:
+        bool next(std::chrono::steady_clock::time_point) override {
+            cv::Mat image(16, 16, CV_8UC3, cv::Scalar(0, 0, 0));
+            image.ptr(5)[3 * 7 + 0] = kMarker[0];
+            image.ptr(5)[3 * 7 + 1] = kMarker[1];
+            image.ptr(5)[3 * 7 + 2] = kMarker[2];
+            publish(image, {}, true);
+            return true;
+        }
+    };
+
+    IP::EventLoop::Task findMarker(IP::EventLoop& loop, int& found) {
+        IP::Result<cv::Point> hit = co_await loop.waitForPixelColor(kMarker, cv::Rect(), 0, std::chrono::milliseconds(60000));
+        if (hit.ok() && *hit == cv::Point(7, 5)) {
+            ++found;
+        }
+    }
+
+    IP::EventLoop::Task waitForAbsentColour(IP::EventLoop& loop, bool& timedOut) {
+        IP::Result<cv::Point> hit = co_await loop.waitForPixelColor(cv::Vec3b(1, 2, 3), cv::Rect(), 0, std::chrono::milliseconds(30));
+        timedOut = hit.error() == IP::ErrorCode::Timeout;
+    }
+
+}
+
+int main() {
+    constexpr int kWaits = 2000;
+
+    {
+        MarkerSource source;
+        IP::EventLoop loop(&source, std::chrono::milliseconds(1));
+        int found = 0;
+        for (int i = 0; i < kWaits; ++i) {
+            loop.spawn(findMarker(loop, found));
+        }
+        const auto start = std::chrono::steady_clock::now();
+        loop.run();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        check(found == kWaits, "every wait resolved on the first frame");
+        check(elapsed < std::chrono::seconds(5), "run() did not sit out the cancelled deadlines");
+        check(loop.pendingTimers() == 0, "cancelled deadlines left the timer heap");
+    }
+
+    {
+        // Cancellations around a live deadline must not disturb it.
+        MarkerSource source;
+        IP::EventLoop loop(&source, std::chrono::milliseconds(1));
+        int found = 0;
+        bool timedOut = false;
+        loop.spawn(waitForAbsentColour(loop, timedOut));
+        for (int i = 0; i < kWaits; ++i) {
+            loop.spawn(findMarker(loop, found));
+        }
+        loop.run();
+
+        check(found == kWaits, "waits resolved next to a pending deadline");
+        check(timedOut, "a wait that never matches still times out");
+        check(loop.pendingTimers() == 0, "timer heap empty once the deadline fired");
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("EventLoopTest passed\n");
+    return 0;
+}
@@ -0,0 +1,225 @@
+// Round trip between IP::MatchClient and IP::MatchServer over a real Unix socket: frames passed
+// through the sealed memfd, path requests refused by default, and malformed or hostile requests
+// answered or dropped without taking the server down.
+
+#include "ImageProccessing.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+    int failures = 0;
+
+    void check(bool condition, const char* what) {
+        if (!condition) {
+            std::fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    // Texture with no repeats, so the template only correlates at the place it was copied to.
+    cv::Mat noise(cv::Size size, uint32_t seed) {
+        cv::Mat image(size, CV_8UC1);
+        for (int y = 0; y < size.height; ++y) {
+            for (int x = 0; x < size.width; ++x) {
+                seed = seed * 1664525u + 1013904223u;
+                image.ptr(y)[x] = static_cast<uchar>(seed >> 24);
+            }
+        }
+        return image;
+    }
+
+    template<typename T>
+    void put(std::vector<uchar>& out, T value) {
+        const uchar* bytes = reinterpret_cast<const uchar*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    // Builds a raw match request the way MatchClient lays it out (see the MatchClient comment).
+    std::vector<uchar> matchRequest(uint8_t source, int rows, int cols, int type, uint64_t step, uint32_t magic = 0x514D5049u) {
+        std::vector<uchar> payload;
+        put(payload, source);
+        put(payload, uint16_t(0));
+        put(payload, int32_t(rows));
+        put(payload, int32_t(cols));
+        put(payload, int32_t(type));
+        put(payload, step);
+        for (int i = 0; i < 4; ++i) {
+            put(payload, int32_t(0));
+        }
+        put(payload, uint8_t(0));
+        put(payload, 0.8);
+        put(payload, int32_t(230));
+        put(payload, uint32_t(1));
+        put(payload, uint32_t(0));
+
+        std::vector<uchar> message;
+        put(message, magic);
+        put(message, uint16_t(1));
+        put(message, uint32_t(1));
+        put(message, uint32_t(payload.size()));
+        message.insert(message.end(), payload.begin(), payload.end());
+        return message;
+    }
+
+    int connectRaw(const std::string& path) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        timeval limit = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+        return fd;
+    }
+
+    void sendRaw(int fd, const std::vector<uchar>& message, int passFd = -1) {
+        iovec part = { const_cast<uchar*>(message.data()), message.size() };
+        msghdr header = {};
+        header.msg_iov = &part;
+        header.msg_iovlen = 1;
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (passFd >= 0) {
+            header.msg_control = control;
+            header.msg_controllen = sizeof(control);
+            cmsghdr* rights = CMSG_FIRSTHDR(&header);
+            rights->cmsg_level = SOL_SOCKET;
+            rights->cmsg_type = SCM_RIGHTS;
+            rights->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(rights), &passFd, sizeof(int));
+        }
+        sendmsg(fd, &header, MSG_NOSIGNAL);
+    }
+
+    // True when the server closed the connection instead of answering.
+    bool closedByServer(int fd) {
+        uchar byte;
+        return recv(fd, &byte, 1, 0) == 0;
+    }
+
+    int frameMemfd(size_t bytes, bool sealed) {
+        int fd = memfd_create("match-test", MFD_CLOEXEC | (sealed ? MFD_ALLOW_SEALING : 0u));
+        if (fd >= 0 && ftruncate(fd, static_cast<off_t>(bytes)) == 0 && sealed) {
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+        }
+        return fd;
+    }
+
+}
+
+int main() {
+    char directory[] = "/tmp/ip-match-test-XXXXXX";
+    if (!mkdtemp(directory)) {
+        std::perror("mkdtemp");
+        return 1;
+    }
+    const std::string path = std::string(directory) + "/match.sock";
+
+    const cv::Mat frameGray = noise(cv::Size(96, 64), 7);
+    const cv::Rect placed(40, 20, 12, 12);
+    const cv::Mat templ = frameGray(placed).clone();
+
+    {
+        IP::MatchServer server(path);
+        server.addTemplate("patch", templ);
+        std::thread serving([&] { server.serve(); });
+
+        struct stat info;
+        check(stat(path.c_str(), &info) == 0 && (info.st_mode & 0777) == 0600, "socket is private to its owner");
+
+        // A client stalled mid-header must not hold up anyone else.
+        int stalled = connectRaw(path);
+        send(stalled, "IPMQ\x01", 5, MSG_NOSIGNAL);
+
+        IP::MatchClient client(path);
+        check(client.templates() == std::vector<std::string>{ "patch" }, "template list");
+
+        // First request attaches the new memfd; the second reuses it without passing a descriptor.
+        cv::Mat shared = client.sharedFrame(frameGray.size(), CV_8UC1);
+        frameGray.copyTo(shared);
+        auto attached = client.match(shared, { 0 });
+        check(attached.size() == 1 && attached[0].ok() && *attached[0] == placed, "match through attached memfd");
+        auto reused = client.match(shared, { 0, 7 });
+        check(reused.size() == 2 && reused[0].ok() && *reused[0] == placed, "match through shared memfd");
+        check(reused.size() == 2 && reused[1].error() == IP::ErrorCode::UnknownTemplate, "unknown template id");
+
+        // A Mat outside the memfd is copied in; a larger frame grows and re-attaches the memfd.
+        cv::Mat frameColour;
+        cv::cvtColor(frameGray, frameColour, cv::COLOR_GRAY2BGR);
+        auto copied = client.match(frameColour, { 0 });
+        check(copied.size() == 1 && copied[0].ok() && *copied[0] == placed, "match through grown memfd");
+
+        auto byPath = client.match(std::string("/etc/hostname"), { 0 });
+        check(byPath.size() == 1 && byPath[0].error() == IP::ErrorCode::NotPermitted, "path requests refused by default");
+
+        bool threw = false;
+        try {
+            client.match(frameGray, std::vector<uint32_t>(40000, 0));
+        }
+        catch (const std::invalid_argument&) {
+            threw = true;
+        }
+        check(threw, "id count capped client side");
+
+        // A step chosen so rows * step wraps must not be trusted as a view into the mapping.
+        int wrapping = connectRaw(path);
+        int sealed = frameMemfd(4096, true);
+        sendRaw(wrapping, matchRequest(1, 2, 4, CV_8UC1, uint64_t(1) << 63), sealed);
+        uchar reply[14 + 4 + 29];
+        size_t got = 0;
+        while (got < sizeof(reply)) {
+            ssize_t part = recv(wrapping, reply + got, sizeof(reply) - got, 0);
+            if (part <= 0) {
+                break;
+            }
+            got += static_cast<size_t>(part);
+        }
+        check(got == sizeof(reply) && reply[14 + 4 + 4] == static_cast<uchar>(IP::ErrorCode::EmptyImage), "wrapping step answered with EmptyImage");
+        close(sealed);
+        close(wrapping);
+
+        int unsealedClient = connectRaw(path);
+        int unsealed = frameMemfd(4096, false);
+        sendRaw(unsealedClient, matchRequest(1, 2, 4, CV_8UC1, 4), unsealed);
+        check(closedByServer(unsealedClient), "unsealed memfd drops the connection");
+        close(unsealed);
+        close(unsealedClient);
+
+        int foreign = connectRaw(path);
+        sendRaw(foreign, matchRequest(0, 2, 4, CV_8UC1, 4, 0xDEADBEEFu));
+        check(closedByServer(foreign), "foreign magic drops the connection");
+        close(foreign);
+
+        int oversized = connectRaw(path);
+        std::vector<uchar> huge;
+        put(huge, uint32_t(0x514D5049u));
+        put(huge, uint16_t(1));
+        put(huge, uint32_t(1));
+        put(huge, uint32_t((1u << 20) + 1));
+        sendRaw(oversized, huge);
+        check(closedByServer(oversized), "oversized length drops the connection");
+        close(oversized);
+
+        check(client.templates().size() == 1, "server still answers after hostile clients");
+
+        close(stalled);
+        server.stop();
+        serving.join();
+    }
+
+    check(access(path.c_str(), F_OK) != 0, "socket removed on shutdown");
+    rmdir(directory);
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("MatchServerTest passed\n");
+    return 0;
+}